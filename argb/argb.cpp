@@ -54,21 +54,286 @@
 #include "argb.h"
 
 // buffers are ordered for fastest transfer by the ISR, see the ISR for detail
-byte   framebuffer_1[ARGB_MAX_X * ARGB_MAX_Y * 3];   // main
-byte   framebuffer_2[ARGB_MAX_X * ARGB_MAX_Y * 3];   // off-screen
+#if ARGB_STATIC_BUFFERS
+static byte buffer_1[ARGB_BUFFER_SIZE(ARGB_PANELS)];   // main
+static byte buffer_2[ARGB_BUFFER_SIZE(ARGB_PANELS)];   // off-screen
+#endif
 
-byte * outbuf = framebuffer_1;
+byte * framebuffer_1 = 0;
+byte * framebuffer_2 = 0;
+
+// bytes in each framebuffer of the current display
+#define FRAME_BYTES ARGB_BYTES(ARGB_MAX_X * ARGB_MAX_Y)
+
+byte ARGB_width  = ARGB_PANEL_SIZE * ARGB_PANELS;
+byte ARGB_height = ARGB_PANEL_SIZE;
+
+byte * outbuf = 0;   // top of the frame the ISR is sending
+
+// buffer the ISR shows from the next frame, changed by SwapBuffers()
+static byte * volatile displaybuf   = 0;
+static volatile byte   swap_pending = 0;
+
+// indexed formats: the palette, RGB order as sent
+#if ARGB_FORMAT != ARGB_RGB24
+static byte palette[ARGB_PALETTE_SIZE][3];
+
+static void LoadPalette(byte index,ARGB color)
+{
+ byte * pc = (byte*)(&color);
+ byte * pe = palette[index & (ARGB_PALETTE_SIZE - 1)];
+
+ *pe     = *(pc+2);
+ *(pe+1) = *(pc+1);
+ *(pe+2) = *pc;
+}
+
+void ARGB_SetPalette(byte index,ARGB color)
+{
+ // the ISR reads the palette, update the entry in one go
+ cli();
+ LoadPalette(index,color);
+ sei();
+}
+
+ARGB ARGB_GetPalette(byte index)
+{
+ byte * pe = palette[index & (ARGB_PALETTE_SIZE - 1)];
+
+ return 0xFF000000 | ((ARGB)*pe << 16) | ((ARGB)*(pe+1) << 8) | *(pe+2);
+}
+
+#endif
+
+// output lookup tables
+#if ARGB_LUT != ARGB_LUT_NONE
+
+const byte ARGB_gamma_P[256] PROGMEM =
+{
+   0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,
+   1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  2,  2,
+   3,  3,  3,  3,  3,  4,  4,  4,  4,  5,  5,  5,  5,  6,  6,  6,
+   6,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10, 11, 11, 11, 12,
+  12, 13, 13, 13, 14, 14, 15, 15, 16, 16, 17, 17, 18, 18, 19, 19,
+  20, 20, 21, 22, 22, 23, 23, 24, 25, 25, 26, 26, 27, 28, 28, 29,
+  30, 30, 31, 32, 33, 33, 34, 35, 35, 36, 37, 38, 39, 39, 40, 41,
+  42, 43, 43, 44, 45, 46, 47, 48, 49, 49, 50, 51, 52, 53, 54, 55,
+  56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71,
+  73, 74, 75, 76, 77, 78, 79, 81, 82, 83, 84, 85, 87, 88, 89, 90,
+  91, 93, 94, 95, 97, 98, 99,100,102,103,105,106,107,109,110,111,
+ 113,114,116,117,119,120,121,123,124,126,127,129,130,132,133,135,
+ 137,138,140,141,143,145,146,148,149,151,153,154,156,158,159,161,
+ 163,165,166,168,170,172,173,175,177,179,181,182,184,186,188,190,
+ 192,194,196,197,199,201,203,205,207,209,211,213,215,217,219,221,
+ 223,225,227,229,231,234,236,238,240,242,244,246,248,251,253,255
+};
+
+#if ARGB_DITHER
+
+// round(1020 * (i / 255) ^ 2.2), the 10 bit curve, split into 4 phases.
+// Phase p adds 1 to the top 8 bits where the low 2 are above {0,2,1,3}[p]
+// so a fraction of n/4 is on for n phases, evenly spread.
+const byte ARGB_dither_P[4][256] PROGMEM =
+{
+ {
+    0,  0,  0,  0,  0,  0,  0,  0,  1,  1,  1,  1,  1,  1,  1,  1,
+    1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  2,  2,  3,  3,  3,
+    3,  3,  3,  4,  4,  4,  4,  4,  5,  5,  5,  5,  6,  6,  6,  7,
+    7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10, 11, 11, 11, 12, 12,
+   13, 13, 13, 14, 14, 15, 15, 16, 16, 17, 17, 18, 18, 19, 19, 20,
+   20, 21, 21, 22, 23, 23, 24, 24, 25, 26, 26, 27, 27, 28, 29, 29,
+   30, 31, 31, 32, 33, 34, 34, 35, 36, 37, 37, 38, 39, 40, 40, 41,
+   42, 43, 44, 45, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 54, 55,
+   56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 69, 70, 71, 72,
+   73, 74, 75, 76, 77, 79, 80, 81, 82, 83, 84, 86, 87, 88, 89, 91,
+   92, 93, 94, 96, 97, 98,100,101,102,104,105,106,108,109,110,112,
+  113,115,116,117,119,120,122,123,125,126,128,129,131,132,134,135,
+  137,139,140,142,143,145,147,148,150,151,153,155,156,158,160,162,
+  163,165,167,168,170,172,174,176,177,179,181,183,185,187,188,190,
+  192,194,196,198,200,202,204,206,207,209,211,213,215,217,219,221,
+  224,226,228,230,232,234,236,238,240,242,245,247,249,251,253,255
+ },
+ {
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    0,  1,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  2,
+    3,  3,  3,  3,  3,  4,  4,  4,  4,  4,  5,  5,  5,  5,  6,  6,
+    6,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10, 10, 11, 11, 12,
+   12, 12, 13, 13, 14, 14, 15, 15, 16, 16, 17, 17, 18, 18, 19, 19,
+   20, 20, 21, 21, 22, 23, 23, 24, 24, 25, 26, 26, 27, 28, 28, 29,
+   30, 30, 31, 32, 32, 33, 34, 35, 35, 36, 37, 38, 38, 39, 40, 41,
+   42, 42, 43, 44, 45, 46, 47, 48, 48, 49, 50, 51, 52, 53, 54, 55,
+   56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71,
+   72, 74, 75, 76, 77, 78, 79, 80, 82, 83, 84, 85, 86, 88, 89, 90,
+   91, 93, 94, 95, 96, 98, 99,100,102,103,104,106,107,108,110,111,
+  113,114,116,117,118,120,121,123,124,126,127,129,130,132,133,135,
+  136,138,140,141,143,144,146,148,149,151,153,154,156,158,159,161,
+  163,164,166,168,170,172,173,175,177,179,180,182,184,186,188,190,
+  192,193,195,197,199,201,203,205,207,209,211,213,215,217,219,221,
+  223,225,227,229,231,233,235,238,240,242,244,246,248,250,253,255
+ },
+ {
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,  1,
+    1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,  2,  2,  2,  3,
+    3,  3,  3,  3,  4,  4,  4,  4,  4,  5,  5,  5,  5,  6,  6,  6,
+    7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10, 10, 11, 11, 11, 12,
+   12, 13, 13, 14, 14, 15, 15, 15, 16, 16, 17, 17, 18, 18, 19, 19,
+   20, 21, 21, 22, 22, 23, 23, 24, 25, 25, 26, 27, 27, 28, 29, 29,
+   30, 31, 31, 32, 33, 33, 34, 35, 36, 36, 37, 38, 39, 39, 40, 41,
+   42, 43, 44, 44, 45, 46, 47, 48, 49, 50, 50, 51, 52, 53, 54, 55,
+   56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 72,
+   73, 74, 75, 76, 77, 78, 79, 81, 82, 83, 84, 85, 87, 88, 89, 90,
+   92, 93, 94, 95, 97, 98, 99,101,102,103,105,106,107,109,110,112,
+  113,114,116,117,119,120,122,123,125,126,127,129,131,132,134,135,
+  137,138,140,141,143,145,146,148,150,151,153,155,156,158,160,161,
+  163,165,166,168,170,172,174,175,177,179,181,183,184,186,188,190,
+  192,194,196,198,199,201,203,205,207,209,211,213,215,217,219,221,
+  223,225,227,229,232,234,236,238,240,242,244,246,249,251,253,255
+ },
+ {
+    0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    0,  0,  0,  0,  1,  1,  1,  1,  1,  1,  1,  1,  2,  2,  2,  2,
+    2,  2,  3,  3,  3,  3,  3,  4,  4,  4,  4,  5,  5,  5,  6,  6,
+    6,  6,  7,  7,  7,  8,  8,  8,  9,  9,  9, 10, 10, 11, 11, 11,
+   12, 12, 13, 13, 14, 14, 14, 15, 15, 16, 16, 17, 17, 18, 18, 19,
+   20, 20, 21, 21, 22, 22, 23, 24, 24, 25, 25, 26, 27, 27, 28, 29,
+   29, 30, 31, 31, 32, 33, 34, 34, 35, 36, 37, 37, 38, 39, 40, 41,
+   41, 42, 43, 44, 45, 46, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55,
+   56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71,
+   72, 73, 74, 76, 77, 78, 79, 80, 81, 83, 84, 85, 86, 87, 89, 90,
+   91, 92, 94, 95, 96, 97, 99,100,101,103,104,105,107,108,110,111,
+  112,114,115,117,118,120,121,123,124,125,127,129,130,132,133,135,
+  136,138,139,141,143,144,146,147,149,151,152,154,156,157,159,161,
+  163,164,166,168,169,171,173,175,177,178,180,182,184,186,188,189,
+  191,193,195,197,199,201,203,205,207,209,211,213,215,217,219,221,
+  223,225,227,229,231,233,235,237,239,242,244,246,248,250,252,255
+ }
+};
+
+#endif
+
+#if ARGB_DEPTH == 12
+
+const byte ARGB_linear_P[256] PROGMEM =
+{
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+   16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+   32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+   48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63,
+   64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79,
+   80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95,
+   96, 97, 98, 99,100,101,102,103,104,105,106,107,108,109,110,111,
+  112,113,114,115,116,117,118,119,120,121,122,123,124,125,126,127,
+  128,129,130,131,132,133,134,135,136,137,138,139,140,141,142,143,
+  144,145,146,147,148,149,150,151,152,153,154,155,156,157,158,159,
+  160,161,162,163,164,165,166,167,168,169,170,171,172,173,174,175,
+  176,177,178,179,180,181,182,183,184,185,186,187,188,189,190,191,
+  192,193,194,195,196,197,198,199,200,201,202,203,204,205,206,207,
+  208,209,210,211,212,213,214,215,216,217,218,219,220,221,222,223,
+  224,225,226,227,228,229,230,231,232,233,234,235,236,237,238,239,
+  240,241,242,243,244,245,246,247,248,249,250,251,252,253,254,255
+};
+
+#endif
+
+#if ARGB_LUT == ARGB_LUT_RAM
+static byte lut_default[256];
+#define LUT_DEFAULT lut_default
+#define LUT_READ(p) (*(p))
+#elif ARGB_DEPTH == 12
+#define LUT_DEFAULT ARGB_linear_P
+#define LUT_READ(p) pgm_read_byte(p)
+#else
+#define LUT_DEFAULT ARGB_gamma_P
+#define LUT_READ(p) pgm_read_byte(p)
+#endif
+
+// read once per line by the ISR
+static const byte * lut_r = LUT_DEFAULT;
+static const byte * lut_g = LUT_DEFAULT;
+static const byte * lut_b = LUT_DEFAULT;
+
+void ARGB_SetLUT(const byte * r,const byte * g,const byte * b)
+{
+ // swap all three in one go, the ISR never sees a mix
+ cli();
+ lut_r = r ? r : LUT_DEFAULT;
+ lut_g = g ? g : LUT_DEFAULT;
+ lut_b = b ? b : LUT_DEFAULT;
+ sei();
+}
+
+void ARGB_BuildLUT(byte * table,byte brightness,byte gain,byte curve)
+{
+ // 0..255 overall scale, +1 so that 255 keeps the curve exact
+ unsigned int scale = (((unsigned int)brightness * gain + 255) >> 8) + 1;
+
+ for (unsigned int i=0;i<256;i++)
+  {
+   unsigned int v = curve == ARGB_CURVE_LINEAR ? i : pgm_read_byte(&ARGB_gamma_P[i]);
+
+   table[i] = (v * scale) >> 8;
+  }
+}
+
+#endif
+
+// How the ISR walks each panel, in the order they are shifted out (the
+// far end of the chain first). Offsets are in bytes from the top of the
+// framebuffer (pixels for INDEX4), so any arrangement or rotation costs
+// the ISR the same.
+#if ARGB_FORMAT == ARGB_RGB24
+#define SCAN_UNIT 3
+#else
+#define SCAN_UNIT 1
+#endif
+
+struct PanelScan
+{
+ int start;       // first pixel sent for line 0
+ int pixel_step;  // to the next pixel sent
+ int line_step;   // to the first pixel of the next line
+};
+
+static PanelScan panel_scan[ARGB_PANELS];
+static byte      panel_count = ARGB_PANELS;
 
 // Note: PORTD=D0..7, PORTB=D8..13, PORTC=AIn 0..5
 //
 //  Pin    Mode    Function
-//  2-3    In      Button inputs for clock 
+//  0-1    In/Out  USART, frame streaming with ARGB_STREAM
+//  2      In/Out  Frame sync with ARGB_SYNC (INT0), out on the master
+//  2-3    In      Button inputs for clock (only 3 with ARGB_SYNC)
 //  4-6    Out     Row Select (0 = top with connector on left)
 //  7      Out     Display Enable
-//  8      Out     MY9221 Clock
-//  9      Out     MY9221 Data
+//  8      Out     MY9221 Clock (bit bang transport)
+//  9      Out     MY9221 Data  (bit bang transport)
+//  10     Out     SPI SS, must be an output for SPI master mode
+//  11     Out     MY9221 Data  (SPI transport, MOSI)
+//  13     Out     MY9221 Clock (SPI transport, SCK via toggle flip-flop)
 //
 
+#if ARGB_TRANSPORT == ARGB_TRANSPORT_SPI
+
+// data and clock lines are driven by the SPI unit, we only use the
+// data line directly to latch
+#define DDR_Data  DDRB
+#define PORT_Data PORTB
+#define BIT_Data  0x08  // digital 11, MOSI
+
+#define DDR_Clk   DDRB
+#define PORT_Clk  PORTB
+#define BIT_Clk   0x20  // digital 13, SCK
+
+#define BIT_SS    0x04  // digital 10
+
+#if ARGB_SPI_2X
+#define SPI_SPSR  _BV(SPI2X)
+#else
+#define SPI_SPSR  0
+#endif
+
+#else
+
 // data and clock lines DDR
 #define DDR_Data  DDRB
 #define PORT_Data PORTB
@@ -78,6 +343,8 @@ byte * outbuf = framebuffer_1;
 #define PORT_Clk  PORTB
 #define BIT_Clk   0x01  // digital 8
 
+#endif
+
 // 3-to-8 decoder and enable (on same port)
 #define DDR_Lines   DDRD
 #define PORT_Lines  PORTD
@@ -85,9 +352,19 @@ byte * outbuf = framebuffer_1;
 #define BIT_Enable  0x80    // display enable
 #define SHIFT_Lines 0x04    // bit shift to get line # to its port bits
 
+// multi controller frame sync, INT0
+#define DDR_Sync    DDRD
+#define PORT_Sync   PORTD
+#define PIN_Sync    PIND
+#define BIT_Sync    0x04    // digital 2
+
 #define DDR_LED     DDRB
 #define PORT_LED    PORTB
+#if ARGB_TRANSPORT == ARGB_TRANSPORT_SPI
+#define BIT_LED     0x00    // D13 is SCK, no second flasher
+#else
 #define BIT_LED     0x20
+#endif
 
 // ADC registers
 // ADMUX:
@@ -103,8 +380,92 @@ byte * outbuf = framebuffer_1;
 #define ADC_ADIE   B00001000  // interrupt enable
 #define ADC_ADPS   B00000111  // prescale, 111 = 128
 
+// byte offset of the pixel wired at column pc, row pr (0,0 top left with
+// the connector on the left) of the panel at tile tx,ty
+static int PanelOffset(byte tx,byte ty,byte rotation,byte pc,byte pr)
+{
+ const byte m = ARGB_PANEL_SIZE - 1;
+ byte lx,ly;  // the pixel of the image shown there
+
+ switch (rotation & 3)
+  {
+   case 0:  lx = pc;     ly = pr;     break;
+   case 1:  lx = pr;     ly = m - pc; break;
+   case 2:  lx = m - pc; ly = m - pr; break;
+   default: lx = m - pr; ly = pc;     break;
+  }
+
+ POINT x = tx * ARGB_PANEL_SIZE + lx;
+ POINT y = ty * ARGB_PANEL_SIZE + ly;
+
+ return SCAN_UNIT * ((ARGB_MAX_X - 1 - x) + y * ARGB_MAX_X);
+}
+
+static void SetupPanels(const ARGB_Geometry & geometry)
+{
+ byte panels = geometry.panels;
+ byte columns;
+
+ if (panels < 1)           panels = 1;
+ if (panels > ARGB_PANELS) panels = ARGB_PANELS;
+
+ switch (geometry.arrangement)
+  {
+   case ARGB_VERTICAL:
+    columns = 1;
+    break;
+
+   case ARGB_TILED:
+    columns = geometry.columns;
+    if (columns < 1 || columns > panels)
+     columns = panels;
+    panels -= panels % columns;   // only whole rows of panels
+    break;
+
+   default:
+    columns = panels;
+    break;
+  }
+
+ ARGB_width  = columns * ARGB_PANEL_SIZE;
+ ARGB_height = (panels / columns) * ARGB_PANEL_SIZE;
+ panel_count = panels;
+
+ for (byte c=0;c<panels;c++)
+  {
+   PanelScan & ps = panel_scan[panels - 1 - c];
+
+   byte tx = c % columns;
+   byte ty = c / columns;
+
+   // pixels of a line go out right to left as wired
+   const byte m = ARGB_PANEL_SIZE - 1;
+
+   ps.start      = PanelOffset(tx,ty,geometry.rotation,m,0);
+   ps.pixel_step = PanelOffset(tx,ty,geometry.rotation,m-1,0) - ps.start;
+   ps.line_step  = PanelOffset(tx,ty,geometry.rotation,m,1)   - ps.start;
+  }
+}
+
+#if ARGB_STATIC_BUFFERS
 void RGBDisplay::init()
 {
+ ARGB_Geometry geometry = {ARGB_PANELS,ARGB_HORIZONTAL,ARGB_PANELS,0};
+
+ init(geometry);
+}
+#endif
+
+void RGBDisplay::init(const ARGB_Geometry & geometry,
+                      byte *                buffer1,
+                      byte *                buffer2)
+{
+#if !ARGB_STATIC_BUFFERS
+ // nothing to scan out, leave TIMER1 and the pins alone
+ if (!buffer1)
+  return;
+#endif
+
  // data output
  DDR_Data  |= BIT_Data;
  PORT_Data &= ~BIT_Data;
@@ -117,15 +478,71 @@ void RGBDisplay::init()
  DDR_Lines  |=  BIT_Lines | BIT_Enable;
  PORT_Lines &= ~(BIT_Lines | BIT_Enable);
 
+#if ARGB_SYNC == ARGB_SYNC_MASTER
+ DDR_Sync  |=  BIT_Sync;
+ PORT_Sync &= ~BIT_Sync;
+#elif ARGB_SYNC == ARGB_SYNC_SLAVE
+ // input, INT0 on both edges
+ DDR_Sync  &= ~BIT_Sync;
+ EICRA      = (EICRA & ~(_BV(ISC01) | _BV(ISC00))) | _BV(ISC00);
+ EIFR       = _BV(INTF0);
+ EIMSK     |= _BV(INT0);
+#endif
+
+#if ARGB_TRANSPORT == ARGB_TRANSPORT_SPI
+ // SS must be an output or the SPI unit can drop out of master mode.
+ // The SPI unit is only enabled by the ISR while shifting.
+ DDR_Data |= BIT_SS;
+ SPCR      = 0;
+ SPSR      = SPI_SPSR;
+#endif
+
  // enable pin 13 cpu board LED
  DDR_LED   |= BIT_LED;
  PORT_LED  |= BIT_LED;
  
+ // the ISR may be running if we are called again
+ cli();
+
+ SetupPanels(geometry);
+
+#if ARGB_STATIC_BUFFERS
+ if (!buffer1)
+  {
+   buffer1 = buffer_1;
+   buffer2 = buffer_2;
+  }
+#endif
+
+ // single buffered if there's no second buffer
+ framebuffer_1 = buffer1;
+ framebuffer_2 = buffer2 ? buffer2 : buffer1;
+
+ memset(framebuffer_1,0,FRAME_BYTES);
+ memset(framebuffer_2,0,FRAME_BYTES);
+
+#if ARGB_LUT == ARGB_LUT_RAM
+ ARGB_BuildLUT(lut_default,255,255);
+#endif
+
+#if ARGB_FORMAT != ARGB_RGB24
+ LoadPalette(0,0);
+
+ for (byte i=0;i<12;i++)
+  LoadPalette(i+1,GetBaseColor(i));
+
+ LoadPalette(13,0xFFFFFFFF);
+ LoadPalette(14,0xFF808080);
+ LoadPalette(15,0xFF202020);
+#endif
+
  // set default buffer we draw into
  outbuf      = framebuffer_1;
+ displaybuf  = framebuffer_1;
 
  // set framebuffer pointer for interrupt routine
  framebuffer = framebuffer_1;
+ ClearDirty();
 
  // Set up the interrupt timer
  // timer count = XTAL / (prescaler * wanted_freq) - 1
@@ -164,54 +581,135 @@ void RGBDisplay::init()
  sei();                 
 }
 
+#if ARGB_SYNC != ARGB_SYNC_NONE
+// sign wide coordinates to this board's, see ARGB_SetCanvas()
+#define CANVAS(x,y) {x -= ARGB_canvas_x; y -= ARGB_canvas_y;}
+#define CANVAS_X    ARGB_canvas_x
+#define CANVAS_Y    ARGB_canvas_y
+#else
+#define CANVAS(x,y)
+#define CANVAS_X    0
+#define CANVAS_Y    0
+#endif
+
+//
+// Dirty rectangle tracking
+//
+
+void RGBDisplay::ClearDirty()
+{
+ dirty_x1 = ARGB_MAX_X;
+ dirty_y1 = ARGB_MAX_Y;
+ dirty_x2 = -1;
+ dirty_y2 = -1;
+}
+
+void RGBDisplay::MarkDirty(POINT x1,POINT y1,POINT x2,POINT y2)
+{
+#if ARGB_FORMAT == ARGB_INDEX4
+ // whole bytes, ie: pixel pairs
+ x1 &= ~1;
+ x2 |=  1;
+#endif
+
+ // clip, callers can pass the unclipped extent of what they draw
+ if (x1 < 0)           x1 = 0;
+ if (y1 < 0)           y1 = 0;
+ if (x2 >= ARGB_MAX_X) x2 = ARGB_MAX_X-1;
+ if (y2 >= ARGB_MAX_Y) y2 = ARGB_MAX_Y-1;
+
+ if (x1 > x2 || y1 > y2)
+  return;  // nothing on screen
+
+ if (x1 < dirty_x1) dirty_x1 = x1;
+ if (y1 < dirty_y1) dirty_y1 = y1;
+ if (x2 > dirty_x2) dirty_x2 = x2;
+ if (y2 > dirty_y2) dirty_y2 = y2;
+}
+
+byte RGBDisplay::GetDirty(POINT & x1,POINT & y1,POINT & x2,POINT & y2)
+{
+ x1 = dirty_x1;
+ y1 = dirty_y1;
+ x2 = dirty_x2;
+ y2 = dirty_y2;
+ return IsDirty();
+}
+
+// copy the dirty rectangle between buffers, a memcpy per row
+static void CopyRect(byte * to,const byte * from,
+                     POINT x1,POINT y1,POINT x2,POINT y2)
+{
+ // pixels are right to left, x2 is the lowest address of each row.
+ // For INDEX4 the dirty rectangle is always whole bytes.
+ unsigned int offset = ARGB_BYTES((ARGB_MAX_X - 1 - x2) + y1 * ARGB_MAX_X);
+ unsigned int len    = ARGB_BYTES(x2 - x1 + 1);
+
+ for (POINT y=y1;y<=y2;y++)
+  {
+   memcpy(to+offset,from+offset,len);
+   offset += ARGB_BYTES(ARGB_MAX_X);
+  }
+}
+
 //
 // These directly manipulate the framebuffer for speed
 //
 
 void RGBDisplay::Clear()
 {
- memset(framebuffer,0,ARGB_MAX_X * ARGB_MAX_Y * 3);
+ memset(framebuffer,0,FRAME_BYTES);
+ MarkAllDirty();
 }
 
-void RGBDisplay::ScrollLeft(byte steps)
+#if ARGB_FORMAT == ARGB_INDEX4
+
+static inline byte GetIndex4(const byte * fb,unsigned int i)
 {
- // scroll pixels left a column
- // pixels are right to left in memory 
+ return (i & 1) ? (fb[i >> 1] & 0x0F) : (fb[i >> 1] >> 4);
+}
 
- // leftmost blue pixel of first row
- byte * pto = framebuffer + 3 * (ARGB_MAX_X - 1) + 2;
+static inline void PutIndex4(byte * fb,unsigned int i,byte v)
+{
+ byte * pb = fb + (i >> 1);
 
- byte line = ARGB_MAX_Y;
- while (line--)
-  {
-   // shifting n-steps pixels and setting the last 'steps' to black
+ if (i & 1)
+  *pb = (*pb & 0xF0) | v;
+ else
+  *pb = (*pb & 0x0F) | (v << 4);
+}
 
-   byte cnt = ARGB_MAX_X-steps;
-   while (cnt--)
+#endif
+
+#if ARGB_FORMAT == ARGB_RGB24
+void RGBDisplay::Fade(byte alpha,byte dirty_only)
+{
+ if (dirty_only)
+  {
+   if (IsDirty())
     {
-     *pto = *(pto-3*steps);  pto--;  // B
-     *pto = *(pto-3*steps);  pto--;  // G
-     *pto = *(pto-3*steps);  pto--;  // R
-    }
- 
-   // now pointing at righthand pixel, zero it
-  
-   cnt = steps;
-   while (cnt--)
-    {  
-     *pto = 0; pto--;
-     *pto = 0; pto--;
-     *pto = 0; pto--;
-    }
+     byte * pb = framebuffer + 3 * ((ARGB_MAX_X - 1 - dirty_x2) + dirty_y1 * ARGB_MAX_X);
+     byte   w  = dirty_x2 - dirty_x1 + 1;
 
-   pto += ARGB_MAX_X * 2 * 3;   // skip to LHS blue pixel of next row
+     for (POINT y=dirty_y1;y<=dirty_y2;y++)
+      {
+       byte cnt = w;
+       while (cnt--)
+        {
+         *pb = ((unsigned int)alpha * (*pb)) >> 8;  pb++;
+         *pb = ((unsigned int)alpha * (*pb)) >> 8;  pb++;
+         *pb = ((unsigned int)alpha * (*pb)) >> 8;  pb++;
+        }
+       pb += 3 * (ARGB_MAX_X - w);
+      }
+    }
+   return;
   }
-}
 
-void RGBDisplay::Fade(byte alpha)
-{
+ MarkAllDirty();
+
  byte * pb = framebuffer;
- byte cnt  = ARGB_MAX_X * ARGB_MAX_Y / 4; // unrolled
+ unsigned int cnt = ARGB_MAX_X * ARGB_MAX_Y / 4; // unrolled
 
  while (cnt--)
   {
@@ -233,15 +731,112 @@ void RGBDisplay::Fade(byte alpha)
   }
 }
 
+void RGBDisplay::Shade(ARGB_Shader shader,ARGB_Shading & s)
+{
+ MarkAllDirty();
+
+ unsigned int u0 = s.u;
+ unsigned int v0 = s.v;
+
+ // rows are stored right to left, start each at its last pixel and step
+ // back towards x = 0. With a canvas u, v, x and y are sign wide.
+ int          right = ARGB_MAX_X - 1 + CANVAS_X;
+ unsigned int ur    = u0 + right * s.du_x + CANVAS_Y * s.du_y;
+ unsigned int vr    = v0 + right * s.dv_x + CANVAS_Y * s.dv_y;
+ byte       * pb    = framebuffer;
+
+ for (s.y=CANVAS_Y;s.y<ARGB_MAX_Y + CANVAS_Y;s.y++)
+  {
+   s.u = ur;
+   s.v = vr;
+
+   for (s.x=right;s.x>=CANVAS_X;s.x--)
+    {
+     shader(pb,s);
+     pb  += 3;
+     s.u -= s.du_x;
+     s.v -= s.dv_x;
+    }
+
+   ur += s.du_y;
+   vr += s.dv_y;
+  }
+
+ s.u = u0;
+ s.v = v0;
+}
+
+void RGBDisplay::BlendBuffers(byte * dst,const byte * a,const byte * b,byte ratio,byte dirty_only)
+{
+ unsigned int start = 0;
+ unsigned int cnt   = ARGB_MAX_X * ARGB_MAX_Y;
+
+ if (dirty_only)
+  {
+   if (!IsDirty())
+    return;
+
+   start = 3 * dirty_y1 * ARGB_MAX_X;
+   cnt   = (dirty_y2 - dirty_y1 + 1) * ARGB_MAX_X;
+  }
+
+ dst += start;
+ a   += start;
+ b   += start;
+
+ // the ends are exact copies
+ if (ratio == 0 || ratio == 255)
+  {
+   memmove(dst,ratio ? b : a,3 * cnt);
+   return;
+  }
+
+ byte r1 = ~ratio;
+
+ // whole rows, a multiple of 4 pixels
+ cnt /= 4; // unrolled
+
+ while (cnt--)
+  {
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+   *dst++ = ((unsigned int)r1 * (*a++) + (unsigned int)ratio * (*b++)) >> 8;
+  }
+}
+
+#endif
+
 void RGBDisplay::Fill(ARGB color)
 {
+ MarkAllDirty();
+
+#if ARGB_FORMAT == ARGB_INDEX8
+ memset(framebuffer,(byte)color,FRAME_BYTES);
+ return;
+#elif ARGB_FORMAT == ARGB_INDEX4
+ memset(framebuffer,((byte)color & 0x0F) * 0x11,FRAME_BYTES);
+ return;
+#endif
+
  byte b   = color;
  byte r   = color >> 8;
  byte g   = color >> 16;
 
  byte * p = framebuffer;
 
- byte cnt = ARGB_MAX_X * ARGB_MAX_Y / 4;   // unrolled
+ unsigned int cnt = ARGB_MAX_X * ARGB_MAX_Y / 4;   // unrolled
  while (cnt--)
   {
    *(p++) = r; *(p++) = g; *(p++) = b;
@@ -251,191 +846,620 @@ void RGBDisplay::Fill(ARGB color)
   }
 }
 
-void RGBDisplay::CopyAltToMain()
+void RGBDisplay::CopyAltToMain(byte dirty_only)
 {
- memcpy(framebuffer_1,framebuffer_2,ARGB_MAX_X * ARGB_MAX_Y * 3);
+ if (!dirty_only)
+  memcpy(framebuffer_1,framebuffer_2,FRAME_BYTES);
+ else
+  if (IsDirty())
+   CopyRect(framebuffer_1,framebuffer_2,dirty_x1,dirty_y1,dirty_x2,dirty_y2);
 }
 
-void RGBDisplay::CopyMainToAlt()
+void RGBDisplay::CopyMainToAlt(byte dirty_only)
 {
- memcpy(framebuffer_2,framebuffer_1,ARGB_MAX_X * ARGB_MAX_Y * 3);
+ if (!dirty_only)
+  memcpy(framebuffer_2,framebuffer_1,FRAME_BYTES);
+ else
+  if (IsDirty())
+   CopyRect(framebuffer_2,framebuffer_1,dirty_x1,dirty_y1,dirty_x2,dirty_y2);
 }
 
-void RGBDisplay::SetPixel(POINT x,POINT y,ARGB color)
+void RGBDisplay::SwapBuffers(byte wait)
 {
- // NOTE: No range checking! Callers must take responsibility
- // pixels ordered row-wise top-right to top-left in RGB order
+ byte * show = framebuffer;
 
- // get blue pixel first
- byte * pb = framebuffer + 2 + 3 * ((ARGB_MAX_X - 1 - x) + (y * ARGB_MAX_X));
+ framebuffer = (show == framebuffer_1) ? framebuffer_2 : framebuffer_1;
 
- // testing determiend its quicker to pluck the bytes rather than shift
- byte * pc = (byte*)(&color);
- byte c_b = *(pc++);
- byte c_g = *(pc++);
- byte c_r = *(pc++);
- byte a   = *(pc++);
+ // the ISR picks this up where it goes back to the top of the frame
+ cli();
+ displaybuf   = show;
+ swap_pending = 1;
+ sei();
 
- byte a1 = ~a;
+ if (wait)
+  while (swap_pending)
+   ;
+}
 
- if (a1)
-  {   
-   // alpha blending
-   *pb = ((unsigned int)a1 * (*pb) + (unsigned int)a * c_b) >> 8;
-   pb--;
-   *pb = ((unsigned int)a1 * (*pb) + (unsigned int)a * c_g) >> 8;
-   pb--;
-   *pb = ((unsigned int)a1 * (*pb) + (unsigned int)a * c_r) >> 8;
-  }
- else
-  {
-   // opaque
-   *(pb--) = c_b;
-   *(pb--) = c_g;
-   *pb     = c_r;
-  }
+byte RGBDisplay::SwapPending()
+{
+ return swap_pending;
 }
 
-void RGBDisplay::HLine(POINT x,POINT y,byte w,ARGB color)
+// index of a pixel. pixels are ordered row-wise right to left
+#define PIXEL_INDEX(x,y) ((ARGB_MAX_X - 1 - (x)) + (y) * ARGB_MAX_X)
+
+// clip a run of len pixels starting at p to 0..max-1, returns the
+// visible length (0 if none) and moves p to the first visible pixel
+static byte ClipRun(POINT & p,int len,POINT max)
 {
- if (y >= 0 && y < ARGB_MAX_Y)
+ if (p < 0)
   {
-   while (x < 0 && w)
-    {
-     x++;
-     w--;
-    }
-   
-   while (w-- && (x < ARGB_MAX_X))
-    SetPixel(x++,y,color);
+   len += p;
+   p    = 0;
   }
+
+ if (len > max - p)
+  len = max - p;
+
+ return (len > 0) ? len : 0;
 }
 
-void RGBDisplay::VLine(POINT x,POINT y,byte w,ARGB color)
+//
+// Span kernels, n pixels from p, the red byte of the first pixel. step is
+// the byte distance to the next pixel: 3 walks a row from its rightmost
+// pixel, 3 * ARGB_MAX_X walks down a column. The colour is unpacked once.
+//
+
+#if ARGB_FORMAT == ARGB_RGB24
+
+static void SpanOpaque(byte * p,byte n,int step,ARGB color)
 {
- if (x >= 0 && x < ARGB_MAX_X)
+ byte * pc = (byte*)(&color);
+ byte c_b = *(pc++);
+ byte c_g = *(pc++);
+ byte c_r = *pc;
+
+ while (n >= 4)
   {
-   while ((y < 0) && w)
-    {
-     y++;
-     w--;
-    }
+   *p = c_r; *(p+1) = c_g; *(p+2) = c_b; p += step;
+   *p = c_r; *(p+1) = c_g; *(p+2) = c_b; p += step;
+   *p = c_r; *(p+1) = c_g; *(p+2) = c_b; p += step;
+   *p = c_r; *(p+1) = c_g; *(p+2) = c_b; p += step;
+   n -= 4;
+  }
 
-   while (w-- && (y < ARGB_MAX_Y))
-    SetPixel(x,y++,color);
+ while (n--)
+  {
+   *p = c_r; *(p+1) = c_g; *(p+2) = c_b; p += step;
   }
 }
 
-void RGBDisplay::DrawRect(POINT x1,POINT y1,POINT x2,POINT y2,ARGB color)
+static void SpanBlend(byte * p,byte n,int step,ARGB color)
 {
- HLine(x1,y1,x2-x1+1,color);
- HLine(x1,y2,x2-x1+1,color);
- if (y1 < y2)
+ byte * pc = (byte*)(&color);
+ byte a    = *(pc+3);
+ byte a1   = ~a;
+
+ // colour side of the blend is the same for every pixel
+ unsigned int c_b = (unsigned int)a * *(pc++);
+ unsigned int c_g = (unsigned int)a * *(pc++);
+ unsigned int c_r = (unsigned int)a * *pc;
+
+ while (n--)
   {
-   VLine(x1,y1+1,y2-y1-1,color);
-   VLine(x2,y1+1,y2-y1-1,color);
+   *p     = ((unsigned int)a1 * (*p)     + c_r) >> 8;
+   *(p+1) = ((unsigned int)a1 * (*(p+1)) + c_g) >> 8;
+   *(p+2) = ((unsigned int)a1 * (*(p+2)) + c_b) >> 8;
+   p += step;
   }
 }
 
-void RGBDisplay::FillRect(POINT x,POINT y,byte w,byte h,ARGB color)
+#elif ARGB_FORMAT == ARGB_INDEX8
+
+static void SpanOpaque1(byte * p,byte n,int step,ARGB color)
 {
- while ((x < 0) && w)
+ while (n--)
   {
-   x++;
-   w--;
+   *p = color;
+   p += step;
   }
+}
 
- while ((y < 0) && h)
-  {
-   y++;
-   h--;
-  }
+#elif ARGB_FORMAT == ARGB_INDEX4
 
- while (h-- && (y < ARGB_MAX_Y))
-  {
-   POINT tx = x;
-   byte  tw = w;
+static void SpanIndex4(byte * fb,unsigned int i,byte n,int step,ARGB color)
+{
+ byte v = (byte)color & 0x0F;
 
-   while (tw >= 4 && tx < (ARGB_MAX_X-3))
+ if (step == 1)
+  {
+   // whole bytes in the middle of a row
+   if ((i & 1) && n)
     {
-     SetPixel(tx++,y,color);
-     SetPixel(tx++,y,color);
-     SetPixel(tx++,y,color);
-     SetPixel(tx++,y,color);
-     tw -= 4;
+     PutIndex4(fb,i++,v);
+     n--;
     }
-    
-   while (tw-- && (tx < ARGB_MAX_X))
-    SetPixel(tx++,y,color);
-   y++;
+
+   memset(fb + (i >> 1),v * 0x11,n >> 1);
+   i += n & ~1;
+   n &= 1;
   }
-}
 
-void RGBDisplay::DrawCircle(POINT poX, POINT poY, byte r, ARGB color)
-{
- char x = -r, y = 0, err = 2-2*r, e2;
- do
+ while (n--)
   {
-   SetPixel(poX-x, poY+y,color);
-   SetPixel(poX+x, poY+y,color);
-   SetPixel(poX+x, poY-y,color);
-   SetPixel(poX-x, poY-y,color);
-   e2 = err;
-   if (e2 <= y)
-    {
-     err += ++y*2+1;
-     if (-x == y && e2 <= x) e2 = 0;
-    }
-   if (e2 > x) err += ++x*2+1;
+   PutIndex4(fb,i,v);
+   i += step;
   }
- while (x <= 0);
 }
 
-void RGBDisplay::FillCircle(POINT poX, POINT poY, byte r, ARGB color)
+#endif
+
+// n pixels from pixel index i, step pixels apart
+template <byte MODE>
+static inline void Span(byte * fb,unsigned int i,byte n,int step,ARGB color)
 {
- char x = -r, y = 0, err = 2-2*r, e2;
- do
+#if ARGB_FORMAT == ARGB_INDEX8
+ if (step == 1)
+  memset(fb + i,(byte)color,n);
+ else
+  SpanOpaque1(fb + i,n,step,color);
+#elif ARGB_FORMAT == ARGB_INDEX4
+ SpanIndex4(fb,i,n,step,color);
+#else
+ if (MODE == ARGB_OPAQUE)
+  SpanOpaque(fb + 3 * i,n,3 * step,color);
+ else
+  SpanBlend(fb + 3 * i,n,3 * step,color);
+#endif
+}
+
+//
+// scrolling. Rows are contiguous right to left, so horizontal moves are
+// a memmove per row and vertical ones a memmove of whole rows. Wrapping
+// rotates pixels in place with three reversals, needing no buffer.
+//
+
+static inline void SwapPixels(byte * fb,unsigned int i,unsigned int j)
+{
+#if ARGB_FORMAT == ARGB_INDEX4
+ byte t = GetIndex4(fb,i);
+
+ PutIndex4(fb,i,GetIndex4(fb,j));
+ PutIndex4(fb,j,t);
+#else
+ byte * pi = fb + ARGB_BYTES(i);
+ byte * pj = fb + ARGB_BYTES(j);
+
+ for (byte b=0;b<ARGB_BYTES(1);b++)
   {
-   VLine(poX-x,poY-y,2*y,color);
-   VLine(poX+x,poY-y,2*y,color);
+   byte t = pi[b];
 
-   e2 = err;
-   if (e2 <= y) 
-    {
-     err += ++y*2+1;
-     if (-x == y && e2 <= x) e2 = 0;
-    }
-   if (e2 > x) err += ++x*2+1;
+   pi[b] = pj[b];
+   pj[b] = t;
   }
- while (x <= 0);
+#endif
 }
 
-void RGBDisplay::DrawLine(POINT x0,POINT y0,POINT x1,POINT y1,ARGB color)
+// reverse the order of n pixels from pixel i, step pixels apart
+static void ReversePixels(byte * fb,unsigned int i,unsigned int n,int step)
 {
- char dx = abs(x1-x0), sx = x0<x1 ? 1 : -1;
- char dy = -abs(y1-y0), sy = y0<y1 ? 1 : -1;
- char err = dx+dy, e2; /* error value e_xy */
+ if (n < 2)
+  return;
 
- for (;;)
-  {
-   if (x0 >= 0 && x0 < ARGB_MAX_X && y0 >= 0 && y0 < ARGB_MAX_Y)
-    SetPixel(x0,y0,color);
-   e2 = 2*err;
-   if (e2 >= dy) /* e_xy+e_x > 0 */
-    { 
-     if (x0 == x1)
-      break;
-     
-     err += dy;
-     x0 += sx;
+ unsigned int j = i + (n - 1) * step;
+
+ for (n/=2;n;n--,i+=step,j-=step)
+  SwapPixels(fb,i,j);
+}
+
+// rotate n pixels from pixel i, step apart, so the k'th gets the k+s'th
+static void RotatePixels(byte * fb,unsigned int i,unsigned int n,unsigned int s,int step)
+{
+ ReversePixels(fb,i,s,step);
+ ReversePixels(fb,i+s*step,n-s,step);
+ ReversePixels(fb,i,n,step);
+}
+
+// moves the rows of a region right by d (left if negative)
+static void ScrollRows(byte * fb,POINT x,POINT y,byte w,byte h,int d,byte wrap)
+{
+ unsigned int s = (d < 0) ? -d : d;
+
+ if (wrap)
+  s %= w;
+ else
+  if (s > w)
+   s = w;
+
+ if (!s)
+  return;
+
+ // rightmost pixel of the top row, the lowest address. Moving right is
+ // pixel k getting k+s in memory.
+ unsigned int i   = PIXEL_INDEX(x+w-1,y);
+ unsigned int rot = (d > 0) ? s : w - s;
+
+ for (;h;h--,i+=ARGB_MAX_X)
+  {
+#if ARGB_FORMAT == ARGB_INDEX4
+   RotatePixels(fb,i,w,rot,1);
+
+   if (!wrap)
+    Span<ARGB_OPAQUE>(fb,(d > 0) ? i + w - s : i,s,1,0);
+#else
+   if (wrap)
+    RotatePixels(fb,i,w,rot,1);
+   else
+    {
+     byte *       p    = fb + ARGB_BYTES(i);
+     unsigned int keep = ARGB_BYTES(w - s);
+     unsigned int gap  = ARGB_BYTES(s);
+
+     if (d > 0)
+      {
+       memmove(p,p+gap,keep);
+       memset(p+keep,0,gap);
+      }
+     else
+      {
+       memmove(p+gap,p,keep);
+       memset(p,0,gap);
+      }
     }
-   if (e2 <= dx) // /* e_xy+e_y < 0 */
+#endif
+  }
+}
+
+// moves the columns of a region down by d (up if negative)
+static void ScrollColumns(byte * fb,POINT x,POINT y,byte w,byte h,int d,byte wrap)
+{
+ unsigned int s = (d < 0) ? -d : d;
+
+ if (wrap)
+  s %= h;
+ else
+  if (s > h)
+   s = h;
+
+ if (!s)
+  return;
+
+ unsigned int i = PIXEL_INDEX(x+w-1,y);
+
+ // rows vacated when not wrapping
+ unsigned int clear = (d > 0) ? i : i + (h - s) * ARGB_MAX_X;
+
+#if ARGB_FORMAT != ARGB_INDEX4
+ if (!wrap)
+  {
+   unsigned int stride = ARGB_BYTES(ARGB_MAX_X);
+   unsigned int len    = ARGB_BYTES(w);
+   byte *       top    = fb + ARGB_BYTES(i);
+
+   if (w == ARGB_MAX_X)
     {
-     if (y0 == y1)
-      break;
-     err += dx;
-     y0 += sy;
+     // whole rows are one block
+     if (d > 0)
+      memmove(top+s*stride,top,(h-s)*stride);
+     else
+      memmove(top,top+s*stride,(h-s)*stride);
+
+     memset(fb+ARGB_BYTES(clear),0,s*stride);
+     return;
+    }
+
+   if (d > 0)
+    for (byte r=h-1;r>=s;r--)
+     memmove(top+r*stride,top+(r-s)*stride,len);
+   else
+    for (byte r=0;r<h-s;r++)
+     memmove(top+r*stride,top+(r+s)*stride,len);
+
+   for (byte r=0;r<s;r++)
+    memset(fb+ARGB_BYTES(clear+r*ARGB_MAX_X),0,len);
+
+   return;
+  }
+#endif
+
+ for (byte c=0;c<w;c++)
+  RotatePixels(fb,i+c,h,(d > 0) ? h - s : s,ARGB_MAX_X);
+
+ if (!wrap)
+  for (byte r=0;r<s;r++)
+   Span<ARGB_OPAQUE>(fb,clear+r*ARGB_MAX_X,w,1,0);
+}
+
+void RGBDisplay::ScrollRect(POINT x,POINT y,byte w,byte h,int dx,int dy,byte wrap)
+{
+ // clip the region to the display
+ POINT x2 = x + w;
+ POINT y2 = y + h;
+
+ if (x < 0)          x  = 0;
+ if (y < 0)          y  = 0;
+ if (x2 > ARGB_MAX_X) x2 = ARGB_MAX_X;
+ if (y2 > ARGB_MAX_Y) y2 = ARGB_MAX_Y;
+
+ if (x2 <= x || y2 <= y)
+  return;
+
+ w = x2 - x;
+ h = y2 - y;
+
+ MarkDirty(x,y,x2-1,y2-1);
+
+ if (dx)
+  ScrollRows(framebuffer,x,y,w,h,dx,wrap);
+
+ if (dy)
+  ScrollColumns(framebuffer,x,y,w,h,dy,wrap);
+}
+
+void RGBDisplay::ScrollLeft(byte steps,byte wrap)
+{
+ ScrollRect(0,0,ARGB_MAX_X,ARGB_MAX_Y,-steps,0,wrap);
+}
+
+void RGBDisplay::ScrollRight(byte steps,byte wrap)
+{
+ ScrollRect(0,0,ARGB_MAX_X,ARGB_MAX_Y,steps,0,wrap);
+}
+
+void RGBDisplay::ScrollUp(byte steps,byte wrap)
+{
+ ScrollRect(0,0,ARGB_MAX_X,ARGB_MAX_Y,0,-steps,wrap);
+}
+
+void RGBDisplay::ScrollDown(byte steps,byte wrap)
+{
+ ScrollRect(0,0,ARGB_MAX_X,ARGB_MAX_Y,0,steps,wrap);
+}
+
+template <byte MODE>
+void RGBDisplay::HLine(POINT x,POINT y,byte w,ARGB color)
+{
+ if (y >= 0 && y < ARGB_MAX_Y)
+  {
+   byte n = ClipRun(x,w,ARGB_MAX_X);
+
+   if (n)
+    {
+     MarkDirty(x,y,x+n-1,y);
+     Span<MODE>(framebuffer,PIXEL_INDEX(x+n-1,y),n,1,color);
+    }
+  }
+}
+
+template <byte MODE>
+void RGBDisplay::VLine(POINT x,POINT y,byte w,ARGB color)
+{
+ if (x >= 0 && x < ARGB_MAX_X)
+  {
+   byte n = ClipRun(y,w,ARGB_MAX_Y);
+
+   if (n)
+    {
+     MarkDirty(x,y,x,y+n-1);
+     Span<MODE>(framebuffer,PIXEL_INDEX(x,y),n,ARGB_MAX_X,color);
+    }
+  }
+}
+
+template <byte MODE>
+void RGBDisplay::DrawRect(POINT x1,POINT y1,POINT x2,POINT y2,ARGB color)
+{
+ HLine<MODE>(x1,y1,x2-x1+1,color);
+ HLine<MODE>(x1,y2,x2-x1+1,color);
+ if (y1 < y2)
+  {
+   VLine<MODE>(x1,y1+1,y2-y1-1,color);
+   VLine<MODE>(x2,y1+1,y2-y1-1,color);
+  }
+}
+
+template <byte MODE>
+void RGBDisplay::FillRect(POINT x,POINT y,byte w,byte h,ARGB color)
+{
+ byte nx = ClipRun(x,w,ARGB_MAX_X);
+ byte ny = ClipRun(y,h,ARGB_MAX_Y);
+
+ if (nx && ny)
+  {
+   MarkDirty(x,y,x+nx-1,y+ny-1);
+
+   // rows are contiguous, start at the rightmost pixel of the top row
+   unsigned int i = PIXEL_INDEX(x+nx-1,y);
+
+   while (ny--)
+    {
+     Span<MODE>(framebuffer,i,nx,1,color);
+     i += ARGB_MAX_X;
+    }
+  }
+}
+
+// where a box is against the display
+#define CLIP_OUT     0
+#define CLIP_IN      1
+#define CLIP_PARTIAL 2
+
+static byte ClipBox(POINT x1,POINT y1,POINT x2,POINT y2)
+{
+ if (x2 < 0 || y2 < 0 || x1 >= ARGB_MAX_X || y1 >= ARGB_MAX_Y)
+  return CLIP_OUT;
+
+ if (x1 >= 0 && y1 >= 0 && x2 < ARGB_MAX_X && y2 < ARGB_MAX_Y)
+  return CLIP_IN;
+
+ return CLIP_PARTIAL;
+}
+
+// circle quadrant q pixel, only range checked if the quadrant is partly off
+#define CirclePlot(q,px,py) \
+ if (clip[q] == CLIP_IN || \
+     (clip[q] && (px) >= 0 && (px) < ARGB_MAX_X && (py) >= 0 && (py) < ARGB_MAX_Y)) \
+  Plot<MODE>(px,py,color)
+
+template <byte MODE>
+void RGBDisplay::DrawCircle(POINT poX, POINT poY, byte r, ARGB color)
+{
+ // each quadrant is clipped once, most are wholly in or out
+ byte clip[4];
+
+ clip[0] = ClipBox(poX,  poY,  poX+r,poY+r);
+ clip[1] = ClipBox(poX-r,poY,  poX,  poY+r);
+ clip[2] = ClipBox(poX-r,poY-r,poX,  poY);
+ clip[3] = ClipBox(poX,  poY-r,poX+r,poY);
+
+ if (!(clip[0] | clip[1] | clip[2] | clip[3]))
+  return;
+
+ MarkDirty(poX-r,poY-r,poX+r,poY+r);
+
+ int x = -r, y = 0, err = 2-2*r, e2;
+ do
+  {
+   CirclePlot(0,poX-x,poY+y);
+   CirclePlot(1,poX+x,poY+y);
+   CirclePlot(2,poX+x,poY-y);
+   CirclePlot(3,poX-x,poY-y);
+   e2 = err;
+   if (e2 <= y)
+    {
+     err += ++y*2+1;
+     if (-x == y && e2 <= x) e2 = 0;
+    }
+   if (e2 > x) err += ++x*2+1;
+  }
+ while (x <= 0);
+}
+
+#undef CirclePlot
+
+template <byte MODE>
+void RGBDisplay::FillCircle(POINT poX, POINT poY, byte r, ARGB color)
+{
+ // the columns are clipped spans, just skip circles that are all off
+ if (ClipBox(poX-r,poY-r,poX+r,poY+r) == CLIP_OUT)
+  return;
+
+ int x = -r, y = 0, err = 2-2*r, e2;
+ do
+  {
+   VLine<MODE>(poX-x,poY-y,2*y,color);
+   VLine<MODE>(poX+x,poY-y,2*y,color);
+
+   e2 = err;
+   if (e2 <= y) 
+    {
+     err += ++y*2+1;
+     if (-x == y && e2 <= x) e2 = 0;
+    }
+   if (e2 > x) err += ++x*2+1;
+  }
+ while (x <= 0);
+}
+
+// the steps k of a line where a coordinate c + s * k is on 0..max-1
+static void ClipSteps(POINT c,int s,POINT max,long & k1,long & k2)
+{
+ if (s > 0)
+  {
+   if (-c > k1)          k1 = -c;
+   if (max - 1 - c < k2) k2 = max - 1 - c;
+  }
+ else
+  {
+   if (c - (max - 1) > k1) k1 = c - (max - 1);
+   if (c < k2)             k2 = c;
+  }
+}
+
+template <byte MODE>
+void RGBDisplay::DrawLine(POINT x0,POINT y0,POINT x1,POINT y1,ARGB color)
+{
+ // Bresenham along the major axis a, step k moving the minor axis b by
+ // j = (2*k*db + da) / (2*da). The line is clipped to the display before
+ // drawing by working out the first and last visible steps, then drawn
+ // as runs of constant b through the span kernels.
+
+ int  dx    = abs(x1-x0), sx = x0<x1 ? 1 : -1;
+ int  dy    = abs(y1-y0), sy = y0<y1 ? 1 : -1;
+ byte steep = dy > dx;
+
+ POINT a0 = steep ? y0 : x0,   b0 = steep ? x0 : y0;
+ int   da = steep ? dy : dx,   db = steep ? dx : dy;
+ int   sa = steep ? sy : sx,   sb = steep ? sx : sy;
+ POINT am = steep ? ARGB_MAX_Y : ARGB_MAX_X;
+ POINT bm = steep ? ARGB_MAX_X : ARGB_MAX_Y;
+
+ // visible steps along a, and visible offsets along b
+ long k1 = 0, k2 = da;
+ long j1 = 0, j2 = db;
+
+ ClipSteps(a0,sa,am,k1,k2);
+ ClipSteps(b0,sb,bm,j1,j2);
+
+ if (k1 > k2 || j1 > j2)
+  return;
+
+ // the steps the b offsets are visible for
+ if (db)
+  {
+   long kb1 = j1 ? (2L * da * j1 - da + 2L * db - 1) / (2L * db) : 0;
+   long kb2 = (2L * da * j2 + da - 1) / (2L * db);
+
+   if (kb1 > k1) k1 = kb1;
+   if (kb2 < k2) k2 = kb2;
+
+   if (k1 > k2)
+    return;
+  }
+
+ // da is only 0 for a single point, keep the divisions below valid
+ if (!da)
+  da = 1;
+
+ long j = (2L * k1 * db + da) / (2L * da);
+ int  e = 2L * k1 * db + da - 2L * da * j;   // 0 .. 2*da-1
+
+ POINT a   = a0 + sa * k1;
+ POINT b   = b0 + sb * j;
+ POINT ra  = a;                              // start of the run
+ int   n   = k2 - k1 + 1;
+
+ // last visible pixel
+ POINT ae = a + sa * (n - 1);
+ POINT be = b0 + sb * ((2L * k2 * db + da) / (2L * da));
+
+ if (steep)
+  MarkDirty(min(b,be),min(a,ae),max(b,be),max(a,ae));
+ else
+  MarkDirty(min(a,ae),min(b,be),max(a,ae),max(b,be));
+
+ while (n--)
+  {
+   e += 2 * db;
+
+   // b moves or the line ends, draw the run so far
+   if (e >= 2 * da || !n)
+    {
+     POINT lo  = min(ra,a);
+     byte  len = abs(a - ra) + 1;
+
+     if (steep)
+      Span<MODE>(framebuffer,PIXEL_INDEX(b,lo),len,ARGB_MAX_X,color);
+     else
+      Span<MODE>(framebuffer,PIXEL_INDEX(lo+len-1,b),len,1,color);
+
+     e  -= 2 * da;
+     b  += sb;
+     ra  = a + sa;
     }
+
+   a += sa;
   }
 }
 
@@ -466,85 +1490,592 @@ const byte numberFont[][3] PROGMEM =
   {0x1F,0x06,0x1F}
  };
 
-void RGBDisplay::DrawDigit(byte digit,
-                           POINT         px,
-                           POINT         py,
-                           ARGB          color)
+template <byte MODE,byte PGM>
+void RGBDisplay::Bitmap1bpp(const byte * bitmap,
+                            POINT        px,
+                            POINT        py,
+                            byte         w,
+                            byte         h,
+                            ARGB         color)
+{
+ if (!w || !h)
+  return;
+
+ MarkDirty(px,py,px+w-1,py+h-1);
+
+ // clip the columns once for every strip
+ POINT c1 = (px < 0) ? -px : 0;
+ POINT c2 = (px + w > ARGB_MAX_X) ? ARGB_MAX_X - px : w;
+
+ if (c1 >= c2)
+  return;
+
+ for (POINT y=py;h;y+=8,bitmap+=w)
+  {
+   byte rows = (h > 8) ? 8 : h;
+   h -= rows;
+
+   // rows of this strip on the display, as a mask and the first one
+   byte mask  = 0xFF >> (8 - rows);
+   byte first = 0;
+
+   if (y < 0)
+    {
+     if (y <= -8)
+      continue;
+
+     first = -y;
+     mask &= 0xFF << first;
+    }
+
+   if (y + 8 > ARGB_MAX_Y)
+    {
+     if (y >= ARGB_MAX_Y)
+      break;
+
+     mask &= 0xFF >> (y + 8 - ARGB_MAX_Y);
+    }
+
+   if (!mask)
+    continue;
+
+   // walk down each column a row at a time
+   unsigned int top = PIXEL_INDEX(px+c1,y+first);
+
+   for (POINT c=c1;c<c2;c++,top--)
+    {
+     byte bits = (PGM ? pgm_read_byte(bitmap+c) : bitmap[c]) & mask;
+
+     bits >>= first;
+
+     for (unsigned int i=top;bits;bits>>=1,i+=ARGB_MAX_X)
+      if (bits & 1)
+       Span<MODE>(framebuffer,i,1,1,color);
+    }
+  }
+}
+
+// bit of a 1bpp bitmap, 0 outside it
+template <byte PGM>
+static inline byte BitmapBit(const byte * bitmap,byte w,byte h,POINT c,POINT r)
+{
+ if (c < 0 || c >= w || r < 0 || r >= h)
+  return 0;
+
+ const byte * p = bitmap + (r >> 3) * w + c;
+
+ return ((PGM ? pgm_read_byte(p) : *p) >> (r & 7)) & 1;
+}
+
+template <byte PGM>
+void RGBDisplay::Bitmap1bppFrac(const byte * bitmap,
+                                POINT        px,
+                                POINT        py,
+                                byte         fx,
+                                byte         fy,
+                                byte         w,
+                                byte         h,
+                                ARGB         color)
+{
+ if (!w || !h)
+  return;
+
+ // a fraction spreads the bitmap into one more column/row
+ POINT ow = w + (fx ? 1 : 0);
+ POINT oh = h + (fy ? 1 : 0);
+
+ MarkDirty(px,py,px+ow-1,py+oh-1);
+
+ POINT c1 = (px < 0) ? -px : 0;
+ POINT c2 = (px + ow > ARGB_MAX_X) ? ARGB_MAX_X - px : ow;
+ POINT r1 = (py < 0) ? -py : 0;
+ POINT r2 = (py + oh > ARGB_MAX_Y) ? ARGB_MAX_Y - py : oh;
+
+#if ARGB_FORMAT == ARGB_RGB24
+ byte * pc = (byte*)(&color);
+ byte   a  = *(pc+3);
+#endif
+
+ for (POINT r=r1;r<r2;r++)
+  for (POINT c=c1;c<c2;c++)
+   {
+    // coverage 0..255, blended across then down from the 4 source bits
+    unsigned int above = (255 - fx) * BitmapBit<PGM>(bitmap,w,h,c,r-1) +
+                         fx * BitmapBit<PGM>(bitmap,w,h,c-1,r-1);
+    unsigned int here  = (255 - fx) * BitmapBit<PGM>(bitmap,w,h,c,r) +
+                         fx * BitmapBit<PGM>(bitmap,w,h,c-1,r);
+    unsigned int v     = (255 - fy) * here + fy * above + 128;
+    byte         cov   = (v + (v >> 8)) >> 8;
+
+    if (!cov)
+     continue;
+
+#if ARGB_FORMAT == ARGB_RGB24
+    *(pc+3) = ((unsigned int)a * cov + 255) >> 8;
+
+    if (*(pc+3) == 255)
+     Plot<ARGB_OPAQUE>(px+c,py+r,color);
+    else
+     Plot<ARGB_BLEND>(px+c,py+r,color);
+#else
+    if (cov >= 128)
+     Plot<ARGB_OPAQUE>(px+c,py+r,color);
+#endif
+   }
+}
+
+template <byte MODE>
+void RGBDisplay::DrawDigit(byte digit,
+                           POINT         px,
+                           POINT         py,
+                           ARGB          color)
+{
+ Bitmap1bpp<MODE,1>(numberFont[digit],px,py,3,8,color);
+}
+
+void RGBDisplay::BlendDigits(byte  digit1,
+                             byte  digit2,
+                             byte  blend,
+                             POINT px,
+                             POINT py,
+                             ARGB  color,
+                             byte  smooth)
+{
+ if (digit1 == digit2)
+  blend = 0;
+
+ // read the 2 character bitmasks from program memory
+ byte shift = blend / 32; // 0..7
+
+ if (smooth && (blend & 31))
+  {
+   // up by shift and a fraction, ie: down by 1 - fraction from one more
+   byte fy = 256 - (blend & 31) * 8;
+
+   if (digit1 != 255)
+    DrawBitmap1bppFrac_P(numberFont[digit1],px,py-shift-1,0,fy,3,8,color);
+
+   if (digit2 != 255)
+    DrawBitmap1bppFrac_P(numberFont[digit2],px,py-shift+6,0,fy,3,8,color);
+
+   return;
+  }
+
+ if (digit1 != 255)
+  DrawDigit(digit1,px,py-shift           ,color);
+
+ if (blend && digit2 != 255)
+  DrawDigit(digit2,px,py-shift+7,color);
+}
+ 
+
+extern byte simpleFont[][8];       // font.c
+extern byte simpleFontWidth[];     // font.c, bearing << 4 | last column
+
+// glyph of a character, unknown ones show as '-'
+static inline byte Glyph(byte ascii)
+{
+ if ((ascii < 0x20) || (ascii > 0x7e))
+  ascii = '-';
+
+ return ascii - 0x20;
+}
+
+byte CharWidth(byte ascii)
+{
+ return pgm_read_byte(&simpleFontWidth[Glyph(ascii)]) & 0x0F;
+}
+
+int MeasureText(const char * str)
+{
+ int width = 0;
+
+ while (*str)
+  width += 1 + CharWidth(*(str++));
+
+ return width;
+}
+
+template <byte MODE>
+byte RGBDisplay::DrawChar(byte ascii,
+                          POINT         px,
+                          POINT         py,
+                          ARGB          color)
+{
+ byte         g      = Glyph(ascii);
+ byte         metric = pgm_read_byte(&simpleFontWidth[g]);
+ byte         width  = metric & 0x0F;
+ const byte * glyph  = simpleFont[g];
+
+ if (!width)
+  return 0;
+
+ // only the lit columns
+ byte bearing = metric >> 4;
+
+ Bitmap1bpp<MODE,1>(glyph+bearing,px+bearing,py,width-bearing+1,8,color);
+
+ return width;
+}
+
+int RGBDisplay::DrawText(const char * str,POINT px,POINT py,ARGB color)
+{
+ POINT x = px;
+
+ // DrawChar() takes the canvas off, only the clipping here needs it
+ for (;*str && x - CANVAS_X < ARGB_MAX_X;str++)
+  {
+   byte width = CharWidth(*str);
+
+   if (x - CANVAS_X + width >= 0)
+    DrawChar(*str,x,py,color);
+
+   x += 1 + width;
+  }
+
+ return x - px + MeasureText(str);
+}
+
+// the alpha specialised primitives used from sketches
+
+#define INSTANTIATE_PRIMITIVES(MODE) \
+ template void RGBDisplay::HLine<MODE>(POINT,POINT,byte,ARGB); \
+ template void RGBDisplay::VLine<MODE>(POINT,POINT,byte,ARGB); \
+ template void RGBDisplay::DrawRect<MODE>(POINT,POINT,POINT,POINT,ARGB); \
+ template void RGBDisplay::FillRect<MODE>(POINT,POINT,byte,byte,ARGB); \
+ template void RGBDisplay::DrawCircle<MODE>(POINT,POINT,byte,ARGB); \
+ template void RGBDisplay::FillCircle<MODE>(POINT,POINT,byte,ARGB); \
+ template void RGBDisplay::DrawLine<MODE>(POINT,POINT,POINT,POINT,ARGB); \
+ template void RGBDisplay::DrawDigit<MODE>(byte,POINT,POINT,ARGB); \
+ template byte RGBDisplay::DrawChar<MODE>(byte,POINT,POINT,ARGB);
+
+INSTANTIATE_PRIMITIVES(ARGB_OPAQUE)
+INSTANTIATE_PRIMITIVES(ARGB_BLEND)
+
+//
+// Run time alpha dispatch: checks alpha once per call rather than once per
+// pixel and skips fully transparent drawing.
+//
+
+#define ALPHA(color) (*(((byte*)&(color))+3))
+
+void RGBDisplay::SetPixel(POINT x,POINT y,ARGB color)
+{
+ CANVAS(x,y);
+
+ byte a = ALPHA(color);
+
+ if (a == 255)
+  SetPixel<ARGB_OPAQUE>(x,y,color);
+ else if (a)
+  SetPixel<ARGB_BLEND>(x,y,color);
+}
+
+void RGBDisplay::HLine(POINT x,POINT y,byte w,ARGB color)
+{
+ CANVAS(x,y);
+
+ byte a = ALPHA(color);
+
+ if (a == 255)
+  HLine<ARGB_OPAQUE>(x,y,w,color);
+ else if (a)
+  HLine<ARGB_BLEND>(x,y,w,color);
+}
+
+void RGBDisplay::VLine(POINT x,POINT y,byte w,ARGB color)
+{
+ CANVAS(x,y);
+
+ byte a = ALPHA(color);
+
+ if (a == 255)
+  VLine<ARGB_OPAQUE>(x,y,w,color);
+ else if (a)
+  VLine<ARGB_BLEND>(x,y,w,color);
+}
+
+void RGBDisplay::DrawRect(POINT x1,POINT y1,POINT x2,POINT y2,ARGB color)
+{
+ CANVAS(x1,y1);
+ CANVAS(x2,y2);
+
+ byte a = ALPHA(color);
+
+ if (a == 255)
+  DrawRect<ARGB_OPAQUE>(x1,y1,x2,y2,color);
+ else if (a)
+  DrawRect<ARGB_BLEND>(x1,y1,x2,y2,color);
+}
+
+void RGBDisplay::FillRect(POINT x,POINT y,byte w,byte h,ARGB color)
+{
+ CANVAS(x,y);
+
+ byte a = ALPHA(color);
+
+ if (a == 255)
+  FillRect<ARGB_OPAQUE>(x,y,w,h,color);
+ else if (a)
+  FillRect<ARGB_BLEND>(x,y,w,h,color);
+}
+
+void RGBDisplay::DrawCircle(POINT poX, POINT poY, byte r, ARGB color)
+{
+ CANVAS(poX,poY);
+
+ byte a = ALPHA(color);
+
+ if (a == 255)
+  DrawCircle<ARGB_OPAQUE>(poX,poY,r,color);
+ else if (a)
+  DrawCircle<ARGB_BLEND>(poX,poY,r,color);
+}
+
+void RGBDisplay::FillCircle(POINT poX, POINT poY, byte r, ARGB color)
+{
+ CANVAS(poX,poY);
+
+ byte a = ALPHA(color);
+
+ if (a == 255)
+  FillCircle<ARGB_OPAQUE>(poX,poY,r,color);
+ else if (a)
+  FillCircle<ARGB_BLEND>(poX,poY,r,color);
+}
+
+void RGBDisplay::DrawLine(POINT x0,POINT y0,POINT x1,POINT y1,ARGB color)
+{
+ CANVAS(x0,y0);
+ CANVAS(x1,y1);
+
+ byte a = ALPHA(color);
+
+ if (a == 255)
+  DrawLine<ARGB_OPAQUE>(x0,y0,x1,y1,color);
+ else if (a)
+  DrawLine<ARGB_BLEND>(x0,y0,x1,y1,color);
+}
+
+void RGBDisplay::DrawBitmap1bpp(const byte * bitmap,POINT px,POINT py,byte w,byte h,ARGB color)
+{
+ CANVAS(px,py);
+
+ byte a = ALPHA(color);
+
+ if (a == 255)
+  Bitmap1bpp<ARGB_OPAQUE,0>(bitmap,px,py,w,h,color);
+ else if (a)
+  Bitmap1bpp<ARGB_BLEND,0>(bitmap,px,py,w,h,color);
+}
+
+void RGBDisplay::DrawBitmap1bpp_P(const byte * bitmap,POINT px,POINT py,byte w,byte h,ARGB color)
+{
+ CANVAS(px,py);
+
+ byte a = ALPHA(color);
+
+ if (a == 255)
+  Bitmap1bpp<ARGB_OPAQUE,1>(bitmap,px,py,w,h,color);
+ else if (a)
+  Bitmap1bpp<ARGB_BLEND,1>(bitmap,px,py,w,h,color);
+}
+
+void RGBDisplay::DrawBitmap1bppFrac(const byte * bitmap,POINT px,POINT py,byte fx,byte fy,byte w,byte h,ARGB color)
+{
+ CANVAS(px,py);
+
+ if (ALPHA(color))
+  Bitmap1bppFrac<0>(bitmap,px,py,fx,fy,w,h,color);
+}
+
+void RGBDisplay::DrawBitmap1bppFrac_P(const byte * bitmap,POINT px,POINT py,byte fx,byte fy,byte w,byte h,ARGB color)
+{
+ CANVAS(px,py);
+
+ if (ALPHA(color))
+  Bitmap1bppFrac<1>(bitmap,px,py,fx,fy,w,h,color);
+}
+
+template <byte PGM>
+static inline byte SpriteByte(const byte * p)
+{
+ return PGM ? pgm_read_byte(p) : *p;
+}
+
+// next pixel of a sprite, from its palette if it has one
+template <byte PGM>
+static inline ARGB SpritePixel(const byte *& p,const byte * palette)
+{
+ const byte * q;
+
+ if (palette)
+  q = palette + 4 * SpriteByte<PGM>(p++);
+ else
+  {
+   q  = p;
+   p += 4;
+  }
+
+ ARGB   color;
+ byte * pc = (byte*)(&color);
+
+ *(pc+3) = SpriteByte<PGM>(q);
+ *(pc+2) = SpriteByte<PGM>(q+1);
+ *(pc+1) = SpriteByte<PGM>(q+2);
+ *pc     = SpriteByte<PGM>(q+3);
+
+ return color;
+}
+
+void RGBDisplay::SpriteRun(POINT x,POINT y,byte n,ARGB color,byte mode)
+{
+ byte a = ALPHA(color);
+
+ // already on this board's coordinates, so not through HLine()
+ if (mode == ARGB_SPRITE_OPAQUE || (mode != ARGB_SPRITE_ALPHA && a) || a == 255)
+  HLine<ARGB_OPAQUE>(x,y,n,color);
+ else if (a)
+  HLine<ARGB_BLEND>(x,y,n,color);
+}
+
+template <byte PGM>
+void RGBDisplay::Sprite(const byte * sprite,POINT px,POINT py,byte mode)
 {
- for (char i=0;i<3;i++)
+ byte         w       = SpriteByte<PGM>(sprite);
+ byte         h       = SpriteByte<PGM>(sprite+1);
+ byte         flags   = SpriteByte<PGM>(sprite+2);
+ const byte * p       = sprite + 3;
+ const byte * palette = 0;
+
+ if (flags & ARGB_SPRITE_PALETTE)
   {
-   POINT plot_x = px + i;
+   unsigned int count = SpriteByte<PGM>(p++);
 
-   if (plot_x >= 0 && plot_x < ARGB_MAX_X)
+   palette = p;
+   p      += 4 * (count ? count : 256);
+  }
+
+ // rows on the display
+ POINT r1 = (py < 0) ? -py : 0;
+ POINT r2 = (py + h > ARGB_MAX_Y) ? ARGB_MAX_Y - py : h;
+
+ if (!w || r1 >= r2 || px >= ARGB_MAX_X || px + w <= 0)
+  return;
+
+ byte  rle    = flags & ARGB_SPRITE_RLE;
+ byte  left   = 0;     // pixels left in the RLE packet
+ byte  repeat = 0;     // the packet is one repeated pixel
+ ARGB  rcolor = 0;
+ POINT r      = 0;
+
+ // uncompressed pixels can be skipped to the first row drawn, packets
+ // have to be read through
+ if (!rle)
+  {
+   p += (unsigned int)r1 * w * (palette ? 1 : 4);
+   r  = r1;
+  }
+
+ for (;r<r2;r++)
+  {
+   POINT run_x = 0;   // pending run of one colour
+   byte  run_n = 0;
+   ARGB  run_c = 0;
+
+   for (POINT c=0;c<w;)
     {
-     byte cdata = pgm_read_byte(&numberFont[digit][i]);
+     ARGB color;
+     byte n = 1;
+
+     if (!rle)
+      color = SpritePixel<PGM>(p,palette);
+     else
+      {
+       if (!left)
+        {
+         byte k = SpriteByte<PGM>(p++);
+
+         left   = (k & 0x7F) + 1;
+         repeat = k & 0x80;
+
+         if (repeat)
+          rcolor = SpritePixel<PGM>(p,palette);
+        }
+
+       if (repeat)
+        {
+         color = rcolor;
+         n     = (left > w - c) ? w - c : left;
+        }
+       else
+        color = SpritePixel<PGM>(p,palette);
+
+       left -= n;
+      }
 
-     for (byte y=0;y<8;y++)
+     if (run_n && color != run_c)
       {
-       POINT plot_y = py+y;
+       if (r >= r1)
+        SpriteRun(px+run_x,py+r,run_n,run_c,mode);
+       run_n = 0;
+      }
 
-       if (plot_y >= 0 && plot_y < ARGB_MAX_Y)
-        if (cdata & (1 << y))
-         SetPixel(plot_x,plot_y,color);
+     if (!run_n)
+      {
+       run_x = c;
+       run_c = color;
       }
+
+     run_n += n;
+     c     += n;
     }
+
+   if (r >= r1)
+    SpriteRun(px+run_x,py+r,run_n,run_c,mode);
   }
 }
 
-void RGBDisplay::BlendDigits(byte  digit1,
-                             byte  digit2,
-                             byte  blend,
-                             POINT px,
-                             POINT py,
-                             ARGB  color)
+void RGBDisplay::DrawSprite(const byte * sprite,POINT px,POINT py,byte mode)
 {
- if (digit1 == digit2)
-  blend = 0;
+ CANVAS(px,py);
 
- // read the 2 character bitmasks from program memory
- byte shift = blend / 32; // 0..7
+ Sprite<0>(sprite,px,py,mode);
+}
 
- if (digit1 != 255)
-  DrawDigit(digit1,px,py-shift           ,color);
+void RGBDisplay::DrawSprite_P(const byte * sprite,POINT px,POINT py,byte mode)
+{
+ CANVAS(px,py);
 
- if (blend && digit2 != 255)
-  DrawDigit(digit2,px,py-shift+7,color);
+ Sprite<1>(sprite,px,py,mode);
 }
- 
 
-byte RGBDisplay::DrawChar(byte ascii,
-                          POINT         px,
-                          POINT         py,
-                          ARGB          color)
+void RGBDisplay::DrawDigit(byte digit,POINT px,POINT py,ARGB color)
 {
- if ((ascii < 0x20) || (ascii > 0x7e))
-  ascii = '-';
+ CANVAS(px,py);
 
- byte width = 0;
+ byte a = ALPHA(color);
 
- for (char i=7;i>=0;i--)
-  {
-   extern byte simpleFont[][8];    // font.c
+ if (a == 255)
+  DrawDigit<ARGB_OPAQUE>(digit,px,py,color);
+ else if (a)
+  DrawDigit<ARGB_BLEND>(digit,px,py,color);
+}
 
-   byte col = pgm_read_byte(&simpleFont[ascii-0x20][i]);
+byte RGBDisplay::DrawChar(byte ascii,POINT px,POINT py,ARGB color)
+{
+ CANVAS(px,py);
 
-   if (col)
-    {
-     if (!width)
-      width = i;
+ byte a = ALPHA(color);
 
-     int plot_x = px + i;
+ if (a == 255)
+  return DrawChar<ARGB_OPAQUE>(ascii,px,py,color);
 
-     if (plot_x >= 0 && plot_x < ARGB_MAX_X)
-      {
-       for (byte f=0;f<8;f++)
-        if (col & (1 << f))
-         SetPixel(px+i,py+f,color);
-      }
-    }
-  }
+ if (a)
+  return DrawChar<ARGB_BLEND>(ascii,px,py,color);
 
- return width;
+ // nothing to draw but callers still lay text out with the width
+ return CharWidth(ascii);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -603,13 +2134,52 @@ ARGB GetRandomColor()
 //
 
 volatile byte          ARGB_user_frame = 0;       // flags one display frame
+volatile unsigned long ARGB_frame_count = 0;      // frames since init()
 volatile unsigned int  ARGB_clock_ms   = 0;       // counts ms within a second
 volatile unsigned long ARGB_clock_tod  = 0;       // seconds within a day
-volatile byte         ARGB_adcdata[ARGB_MAX_Y];   // analog samples
+volatile byte         ARGB_adcdata[ARGB_LINES];   // analog samples
+
+#if ARGB_ADC_RING
+volatile byte          ARGB_adcring[ARGB_ADC_RING];
+volatile byte          ARGB_adc_ready  = 0;
+volatile unsigned long ARGB_adc_blocks = 0;
+static volatile byte   adc_pos         = 0;       // next sample in the ring
+#endif
 
 // enable for darker display (eg:night mode)
 byte                   ARGB_dark      = 0;
 
+// grayscale depth sent, ARGB_DEPTH unless the ISR had to fall back to 8
+volatile byte          ARGB_depth     = ARGB_DEPTH;
+
+#if ARGB_TRANSPORT == ARGB_TRANSPORT_SPI
+
+// MSB first, mode 0. Each SCK rising edge toggles DCKI via the external
+// flip-flop, so each SPI bit is one MY9221 bit.
+#define SPI_SPCR (_BV(SPE) | _BV(MSTR))
+
+static inline void SendByte(byte data)
+{
+ SPDR = data;
+ while (!(SPSR & _BV(SPIF)))
+  ;
+}
+
+static inline void Send16Bit(unsigned int data)
+{
+ SendByte(data >> 8);
+ SendByte(data);
+}
+
+static inline void SendPixel(byte data)
+{
+ // top byte is always 0
+ SendByte(0);
+ SendByte(data);
+}
+
+#else
+
 static void Send16Bit(unsigned int data)
 {
  // notes:
@@ -649,9 +2219,62 @@ static void SendPixel(byte data)
  PORT_Data = (data&0x01) ? (PORT_Data | BIT_Data) : (PORT_Data & ~BIT_Data); PORT_Clk ^= BIT_Clk;
 }
 
-#define SendRPixel(a)  SendPixel(a)
-#define SendGPixel(a)  SendPixel(a)
-#define SendBPixel(a)  SendPixel(a)
+#endif
+
+#if ARGB_DEPTH == 12
+
+const unsigned int ARGB_gamma12_P[256] PROGMEM =
+{
+    0,   0,   0,   0,   0,   1,   1,   2,   2,   3,   3,   4,   5,   6,   7,   8,
+    9,  11,  12,  14,  15,  17,  19,  21,  23,  25,  27,  29,  32,  34,  37,  40,
+   43,  46,  49,  52,  55,  59,  62,  66,  70,  73,  77,  82,  86,  90,  95,  99,
+  104, 109, 114, 119, 124, 129, 135, 140, 146, 152, 158, 164, 170, 176, 182, 189,
+  196, 202, 209, 216, 224, 231, 238, 246, 254, 261, 269, 277, 286, 294, 302, 311,
+  320, 328, 337, 347, 356, 365, 375, 384, 394, 404, 414, 424, 435, 445, 456, 467,
+  477, 488, 500, 511, 522, 534, 545, 557, 569, 581, 594, 606, 619, 631, 644, 657,
+  670, 683, 697, 710, 724, 738, 752, 766, 780, 794, 809, 823, 838, 853, 868, 884,
+  899, 914, 930, 946, 962, 978, 994,1011,1027,1044,1061,1078,1095,1112,1130,1147,
+ 1165,1183,1201,1219,1237,1256,1274,1293,1312,1331,1350,1370,1389,1409,1429,1449,
+ 1469,1489,1509,1530,1551,1572,1593,1614,1635,1657,1678,1700,1722,1744,1766,1789,
+ 1811,1834,1857,1880,1903,1926,1950,1974,1997,2021,2045,2070,2094,2119,2143,2168,
+ 2193,2219,2244,2270,2295,2321,2347,2373,2400,2426,2453,2479,2506,2534,2561,2588,
+ 2616,2644,2671,2700,2728,2756,2785,2813,2842,2871,2900,2930,2959,2989,3019,3049,
+ 3079,3109,3140,3170,3201,3232,3263,3295,3326,3358,3390,3421,3454,3486,3518,3551,
+ 3584,3617,3650,3683,3716,3750,3784,3818,3852,3886,3920,3955,3990,4025,4060,4095
+};
+
+// 4096 grayscale clocks of the MY9221 internal oscillator (~8.6MHz)
+#define PWM12_US 480
+
+// The display is enabled from 70us after the shift out (the compare B
+// phases) until the next line starts. The shift out of a 12 bit line must
+// end early enough for that to cover a whole PWM cycle, plus a margin.
+#define DEPTH12_BUDGET (USECOUNTER - US_TICKS(70 + PWM12_US + 20))
+
+// 12 bit value from the gamma table, its top 8 bits after a fallback.
+// shift is set by the ISR for each line.
+#define SendValue(v) Send16Bit(pgm_read_word(&ARGB_gamma12_P[v]) >> shift)
+
+#else
+
+#define SendValue(v) SendPixel(v)
+
+#endif
+
+#if ARGB_LUT != ARGB_LUT_NONE
+
+// lr,lg,lb are the ISR's copies of the table pointers
+#define SendRPixel(a)  SendValue(LUT_READ(lr + (a)))
+#define SendGPixel(a)  SendValue(LUT_READ(lg + (a)))
+#define SendBPixel(a)  SendValue(LUT_READ(lb + (a)))
+
+#else
+
+#define SendRPixel(a)  SendValue(a)
+#define SendGPixel(a)  SendValue(a)
+#define SendBPixel(a)  SendValue(a)
+
+#endif
 
 void ARGB_SetTime(unsigned long new_tod)
 {
@@ -664,102 +2287,579 @@ void ARGB_SetTime(unsigned long new_tod)
  sei();
 }
 
-// This ISR is called when TIMER1 matches the count  
-ISR(TIMER1_COMPA_vect)          
+void ARGB_GetTime(ARGB_Time & time)
 {
- static byte line       = 0;  // line we are about to send
+ // one short critical section, the ISR updates these at frame end
+ cli();
+ unsigned long frames = ARGB_frame_count;
 
- // MY9221 commands
- // 0x0400 = hi speed (didn't help 12 bit mode)
- // 0x0100 = 12 bit (too slow to use)
- // 0x0010 = APDM waveform
+ time.tod    = ARGB_clock_tod;
+ time.ms     = ARGB_clock_ms;
+ sei();
 
- const unsigned int CmdMode = 0x0010;
+ time.frames = frames;
+ time.uptime = frames * ARGB_FRAME_MS;
+}
 
- int panels = ARGB_PANELS;
+unsigned long ARGB_Frames()
+{
+ cli();
+ unsigned long frames = ARGB_frame_count;
+ sei();
 
- // disable early, make display darker
- if (ARGB_dark)
-  PORT_Lines &= ~BIT_Enable;
+ return frames;
+}
 
- while (panels--)
-  { 
-   // Data is in a linear array (R,G,B) with pixels in right to left order
-   // as expected by the Rainbow Block
+unsigned long ARGB_Uptime()
+{
+ return ARGB_Frames() * ARGB_FRAME_MS;
+}
 
-   Send16Bit(CmdMode);
-   SendRPixel(*(outbuf++));  SendGPixel(*(outbuf++));  SendBPixel(*(outbuf++));
-   SendRPixel(*(outbuf++));  SendGPixel(*(outbuf++));  SendBPixel(*(outbuf++));
-   SendRPixel(*(outbuf++));  SendGPixel(*(outbuf++));  SendBPixel(*(outbuf++));
-   SendRPixel(*(outbuf++));  SendGPixel(*(outbuf++));  SendBPixel(*(outbuf++));
-        
-   Send16Bit(CmdMode);
-   SendRPixel(*(outbuf++));  SendGPixel(*(outbuf++));  SendBPixel(*(outbuf++));
-   SendRPixel(*(outbuf++));  SendGPixel(*(outbuf++));  SendBPixel(*(outbuf++));
-   SendRPixel(*(outbuf++));  SendGPixel(*(outbuf++));  SendBPixel(*(outbuf++));
-   SendRPixel(*(outbuf++));  SendGPixel(*(outbuf++));  SendBPixel(*(outbuf++));
+// The line refresh is split into phases so no time is spent busy waiting
+// with interrupts masked. TIMER1 compare A shifts out the line data then
+// arms compare B to run each following phase after the MY9221 settle times.
+//
+//  A  shift line data out
+//  B  PHASE_BLANK:  30us later, blank the display
+//  B  PHASE_LATCH:  10us later, select the row, latch and do housekeeping
+//  B  PHASE_ENABLE: 30us later, enable the display
+
+#define PHASE_IDLE   0
+#define PHASE_BLANK  1
+#define PHASE_LATCH  2
+#define PHASE_ENABLE 3
+
+#define US_TICKS(us) ((us) * (16000000L / 1000000L))
+
+static byte line  = 0;           // line we are about to send
+static byte phase = PHASE_IDLE;  // next compare B phase
+
+#if ARGB_STATS
+
+// current line so far, and the lines since the last reset
+static unsigned int           stat_line   = 0;
+static unsigned int           stat_min    = 0xFFFF;
+static unsigned int           stat_max    = 0;
+static unsigned long          stat_sum    = 0;
+static unsigned int           stat_lines  = 0;
+static unsigned long          stat_frames = 0;
+static unsigned long          stat_missed = 0;
+
+// time the ISR code between the two, added to the current line
+#define STATS_START() unsigned int stat_t0 = TCNT1
+#define STATS_END()   stat_line += TCNT1 - stat_t0
+
+static inline void StatsLine()
+{
+ // the previous line is complete (none yet after init)
+ if (!stat_line)
+  return;
+
+ // halve the totals before they overflow, the average follows recent lines
+ if (stat_lines == 0xFFFF)
+  {
+   stat_sum   >>= 1;
+   stat_lines >>= 1;
+  }
+
+ stat_sum += stat_line;
+ stat_lines++;
+
+ if (stat_line < stat_min) stat_min = stat_line;
+ if (stat_line > stat_max) stat_max = stat_line;
+
+ stat_line = 0;
+}
+
+void ARGB_GetStats(ARGB_Stats& stats)
+{
+ cli();
+ unsigned long sum   = stat_sum;
+ unsigned int  lines = stat_lines;
+
+ stats.min_ticks  = lines ? stat_min : 0;
+ stats.max_ticks  = stat_max;
+ stats.frames     = stat_frames;
+ stats.missed     = stat_missed;
+ sei();
+
+ stats.avg_ticks  = lines ? sum / lines : 0;
+ stats.line_ticks = USECOUNTER + 1;
+ stats.load       = (unsigned long)stats.avg_ticks * 100 / stats.line_ticks;
+}
+
+void ARGB_ResetStats()
+{
+ cli();
+ stat_min    = 0xFFFF;
+ stat_max    = 0;
+ stat_sum    = 0;
+ stat_lines  = 0;
+ stat_frames = 0;
+ stat_missed = 0;
+ sei();
+}
+
+#else
+
+#define STATS_START()
+#define STATS_END()
+
+#endif
+
+#if ARGB_ADC_RING
+
+const volatile byte * ARGB_GetADCBlock(unsigned long & block)
+{
+ cli();
+ byte ready = ARGB_adc_ready;
+ byte pos   = adc_pos;
+ block      = ARGB_adc_blocks - 1;
+ ARGB_adc_ready = 0;
+ sei();
+
+ if (!ready)
+  return 0;
+
+ // the half the ISR is not filling
+ return (pos < ARGB_ADC_RING / 2) ? ARGB_adcring + ARGB_ADC_RING / 2 : ARGB_adcring;
+}
+
+byte ARGB_BeatDetect(const volatile byte * samples,byte n,ARGB_Beat & beat,byte ratio)
+{
+ if (!n)
+  return beat.beat = 0;
+
+ // remove the DC offset first, the input is biased to mid rail
+ unsigned int sum = 0;
+ for (byte i=0;i<n;i++)
+  sum += samples[i];
+
+ byte mean = sum / n;
+
+ unsigned long sq = 0;
+ for (byte i=0;i<n;i++)
+  {
+   // squared unsigned, d * d as int overflows past 181
+   unsigned int d = (samples[i] > mean) ? samples[i] - mean : mean - samples[i];
+   sq += d * d;
   }
 
- // MY9221 datasheet specifies 220us before latching data just sent.
- // The delays below are less but working on 4 display boards I've tried
- // plus we spend some time doing other housekeeping before latching.
+ unsigned int energy = sq / n;
+ unsigned int avg    = beat.average;
 
- delayMicroseconds(30);
+ beat.beat   = avg && energy > 16 && ((unsigned long)energy << 4) > (unsigned long)avg * ratio;
+ beat.energy = energy;
 
- // Use this time to blank the display and select the row
- // for the data just clocked in.
- // note: the blanking is quicker than the line decoding
- // note: delay above and below is split up to minimise blank time
+ // the average moves 1/16 of the way each block
+ beat.average = avg + ((long)energy - avg) / 16;
 
- PORT_Lines &= ~BIT_Enable;
- delayMicroseconds(10);
- PORT_Lines = (PORT_Lines & ~BIT_Lines) | (line << SHIFT_Lines);
+ return beat.beat;
+}
+
+#endif
+
+#if ARGB_SYNC != ARGB_SYNC_NONE
+
+POINT ARGB_canvas_x = 0;
+POINT ARGB_canvas_y = 0;
+
+void ARGB_SetCanvas(POINT x,POINT y)
+{
+ ARGB_canvas_x = x;
+ ARGB_canvas_y = y;
+}
+
+#endif
 
- // save 1.25ms analog samples. we set up the next sample after reading
- // the previous so it will definitely be ready by the next interrupt
- // application can use these for CRO, beat detect, etc.
+#if ARGB_SYNC == ARGB_SYNC_MASTER
 
- ARGB_adcdata[line] = ADCH;   // 8 bit ADC read
- ADCSRA |= ADC_ADSC;          // start next read
+// The pulse starts as the last line of a frame is enabled, a quiet time
+// for the slaves' interrupts which are in step. It ends at the blank of
+// the next line, or the one after for frames that are a multiple of 256,
+// which the slaves use to line up their frame counts.
+static byte sync_pulse = 0;   // blank phases to go before it ends
 
- // latch data for the row we just clocked in
+#elif ARGB_SYNC == ARGB_SYNC_SLAVE
 
- PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data;
- PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data;
+#define SYNC_LINE  (USECOUNTER + 1L)
+#define SYNC_FRAME (SYNC_LINE * ARGB_LINES)
 
- // end of frame & timekeeping updates
+volatile byte ARGB_sync_locked = 0;
+volatile int  ARGB_sync_error  = 0;
+
+static volatile int  sync_trim    = 0;   // added to each line this frame
+static int           sync_freq    = 0;   // integral, ticks per line * 64
+static unsigned int  sync_enable  = 0;   // TCNT1 when our last line enabled
+static long          sync_rise    = 0;   // frame position of the pulse
+static byte          sync_missing = 0;   // frames without a pulse
+static byte          sync_hold    = 0;   // frame ends not counted, we are ahead
+
+// ticks into the frame, from the start of line 0's slot
+static inline long SyncPosition()
+{
+ unsigned int t    = TCNT1;
+ byte         slot = line;
+
+ // line moves on at the latch, until the next line starts
+ if (!(TIFR1 & _BV(OCF1A)) && phase != PHASE_BLANK && phase != PHASE_LATCH)
+  slot = (line - 1) & (ARGB_LINES - 1);
+
+ return slot * SYNC_LINE + t;
+}
+
+ISR(INT0_vect)
+{
+ long pos = SyncPosition();
 
- if (++line >= ARGB_MAX_Y)
+ if (PIN_Sync & BIT_Sync)
   {
-   line            = 0;                   // just sent out bottom line
-   ARGB_user_frame = 1;                   // 1/framerate has passed
-   outbuf          = framebuffer_1;       // back to top of framebuffer
+   // phase error against where our own last line enabled, wrapped to
+   // +- half a frame. Positive means we are ahead, so lengthen lines.
+   long e = pos - ((ARGB_LINES - 1) * SYNC_LINE + sync_enable);
 
-   ARGB_clock_ms += 1000/ARGB_FRAMERATE;  // one frame has passed, 10ms or 8ms
+   if (e >= SYNC_FRAME / 2)  e -= SYNC_FRAME;
+   if (e < -SYNC_FRAME / 2)  e += SYNC_FRAME;
 
-   if (ARGB_clock_ms >= 1000)
+   // integrate only near lock, so a big initial error doesn't wind up
+   if (e > -512 && e < 512)
     {
-     // one second passed
+     sync_freq += e;
+     if (sync_freq >  8192) sync_freq =  8192;
+     if (sync_freq < -8192) sync_freq = -8192;
+    }
+
+   // the phase error taken out over the next frame's lines
+   long trim = (e >> 3) + (sync_freq >> 6);
+
+   if (trim >  (long)(SYNC_LINE / 16)) trim =  SYNC_LINE / 16;
+   if (trim < -(long)(SYNC_LINE / 16)) trim = -(long)(SYNC_LINE / 16);
+
+   sync_trim        = trim;
+   sync_rise        = pos;
+   sync_missing     = 0;
+   ARGB_sync_error  = (e > 32767) ? 32767 : (e < -32767) ? -32767 : e;
+   ARGB_sync_locked = (e > -US_TICKS(20) && e < US_TICKS(20));
+  }
+ else
+  {
+   long w = pos - sync_rise;
+
+   if (w < 0)
+    w += SYNC_FRAME;
 
-     ARGB_clock_ms = 0;              // either 8ms or 10ms are integer factors of 1000
-     ARGB_clock_tod++;
-     if (ARGB_clock_tod >= 86400)    // roll over on day
-      ARGB_clock_tod = 0;
+   // a long pulse marks a multiple of 256 frames, round ours to the
+   // nearest. Frames never count back: when that is behind us, hold the
+   // count until the master catches up.
+   if (w > SYNC_LINE + SYNC_LINE / 2)
+    {
+     unsigned long frames = (ARGB_frame_count + 128) & ~0xFFUL;
 
-     PORT_LED  |= BIT_LED;      // turn on board LED on the second
+     if (frames >= ARGB_frame_count)
+      {
+       ARGB_frame_count = frames;
+       sync_hold        = 0;
+      }
+     else
+      sync_hold = ARGB_frame_count - frames;
     }
-   else
-    if (ARGB_clock_ms >= 20)
-     PORT_LED      &= ~BIT_LED; // turn off board LED after 50ms
   }
+}
+
+#endif
+
+static inline void ArmPhase(byte next,unsigned int ticks)
+{
+ // timed from now rather than the last match so a long phase can never
+ // shorten the following delay. TCNT1 stays well below OCR1A here.
+
+ phase  = next;
+ OCR1B  = TCNT1 + ticks;
+ TIFR1  = _BV(OCF1B);    // discard any stale match
+}
+
+static void LinePhase()
+{
+ switch (phase)
+  {
+   case PHASE_BLANK:
+
+#if ARGB_SYNC == ARGB_SYNC_MASTER
+    if (sync_pulse && !--sync_pulse)
+     PORT_Sync &= ~BIT_Sync;
+#endif
+
+    // MY9221 datasheet specifies 220us before latching data just sent.
+    // The delays are less but working on 4 display boards I've tried
+    // plus we spend some time doing other housekeeping before latching.
+    //
+    // Use this time to blank the display and select the row
+    // for the data just clocked in.
+    // note: the blanking is quicker than the line decoding
+    // note: delay before and after is split up to minimise blank time
+
+    PORT_Lines &= ~BIT_Enable;
+    ArmPhase(PHASE_LATCH,US_TICKS(10));
+    break;
+
+   case PHASE_LATCH:
+
+    PORT_Lines = (PORT_Lines & ~BIT_Lines) | (line << SHIFT_Lines);
+
+    // save 1.25ms analog samples. we set up the next sample after reading
+    // the previous so it will definitely be ready by the next interrupt
+    // application can use these for CRO, beat detect, etc.
+
+    {
+     byte sample = ADCH;         // 8 bit ADC read
+     ADCSRA |= ADC_ADSC;         // start next read
+
+     ARGB_adcdata[line] = sample;
+
+#if ARGB_ADC_RING
+     byte pos = adc_pos;
+
+     ARGB_adcring[pos] = sample;
+     pos = (pos + 1) & (ARGB_ADC_RING - 1);
+     adc_pos = pos;
+
+     if (pos == ARGB_ADC_RING / 2)
+      {
+       ARGB_adc_ready |= ARGB_ADC_HALF;
+       ARGB_adc_blocks++;
+      }
+     else if (!pos)
+      {
+       ARGB_adc_ready |= ARGB_ADC_FULL;
+       ARGB_adc_blocks++;
+      }
+#endif
+    }
+
+    // latch data for the row we just clocked in
+
+    PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data;
+    PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data; PORT_Data ^= BIT_Data;
+
+    // end of frame & timekeeping updates
+
+    if (++line >= ARGB_LINES)
+     {
+#if ARGB_STATS
+      stat_frames++;
+      if (ARGB_user_frame)                   // app didn't keep up
+       stat_missed++;
+#endif
+
+      line            = 0;                   // just sent out bottom line
+      ARGB_user_frame = 1;                   // 1/framerate has passed
+#if ARGB_SYNC == ARGB_SYNC_SLAVE
+      if (sync_hold)                         // ahead of the master
+       sync_hold--;
+      else
+#endif
+      ARGB_frame_count++;
+      outbuf          = displaybuf;          // back to top of framebuffer
+      swap_pending    = 0;                   // any page flip now done
+
+      ARGB_clock_ms += ARGB_FRAME_MS;        // one frame has passed, 10ms or 8ms
+
+      if (ARGB_clock_ms >= 1000)
+       {
+        // one second passed
+
+        ARGB_clock_ms = 0;              // either 8ms or 10ms are integer factors of 1000
+        ARGB_clock_tod++;
+        if (ARGB_clock_tod >= 86400)    // roll over on day
+         ARGB_clock_tod = 0;
+
+        PORT_LED  |= BIT_LED;      // turn on board LED on the second
+       }
+      else
+       if (ARGB_clock_ms >= 20)
+        PORT_LED      &= ~BIT_LED; // turn off board LED after 50ms
+     }
+
+    // give new row data time to settle before renabling display
+    // anything less than this creates ghosts
+    // note: MY9221 in 8 bit mode latches quickly, in >= 12 bit mode
+    //       it did not latch before the next interrupt.
+
+    ArmPhase(PHASE_ENABLE,US_TICKS(30));
+    break;
+
+   case PHASE_ENABLE:
+
+    PORT_Lines |= BIT_Enable;  
+    phase       = PHASE_IDLE;
+    TIMSK1     &= ~_BV(OCIE1B);
+
+    // the last line of the frame is on
+    if (!line)
+     {
+#if ARGB_SYNC == ARGB_SYNC_MASTER
+      PORT_Sync |= BIT_Sync;
+      sync_pulse = ((byte)ARGB_frame_count) ? 1 : 2;
+#elif ARGB_SYNC == ARGB_SYNC_SLAVE
+      sync_enable = TCNT1;
+#endif
+     }
+    break;
+  }
+}
+
+// This ISR is called when TIMER1 matches the count  
+// send the pixel at p and move to the next one on the line
+#if ARGB_FORMAT == ARGB_INDEX8
+#define SendNextPixel() \
+ { byte * pe = palette[*p & (ARGB_PALETTE_SIZE - 1)]; \
+   SendRPixel(*pe);  SendGPixel(*(pe+1));  SendBPixel(*(pe+2));  p += step; }
+#elif ARGB_FORMAT == ARGB_INDEX4
+#define SendNextPixel() \
+ { byte v = outbuf[p >> 1]; \
+   byte * pe = palette[(p & 1) ? (v & 0x0F) : (v >> 4)]; \
+   SendRPixel(*pe);  SendGPixel(*(pe+1));  SendBPixel(*(pe+2));  p += step; }
+#else
+#define SendNextPixel() \
+ { SendRPixel(*p);  SendGPixel(*(p+1));  SendBPixel(*(p+2));  p += step; }
+#endif
+
+ISR(TIMER1_COMPA_vect)          
+{
+ // MY9221 commands
+ // 0x0400 = hi speed (didn't help 12 bit mode)
+ // 0x0100 = 12 bit (needs ARGB_DEPTH 12, too slow with bitbang)
+ // 0x0010 = APDM waveform
+
+#if ARGB_DEPTH == 12
+ byte               shift   = (ARGB_depth == 12) ? 0 : 4;
+ const unsigned int CmdMode = shift ? 0x0010 : 0x0110;
+#else
+ const unsigned int CmdMode = 0x0010;
+#endif
+
+ PanelScan * ps     = panel_scan;
+ byte        panels = panel_count;
+
+ STATS_START();
+
+#if ARGB_SYNC == ARGB_SYNC_SLAVE
+ // TCNT1 has just restarted so the new top can't have been passed
+ if (!line && ++sync_missing > 4)
+  {
+   // no master, free run at the learnt rate
+   sync_missing     = 4;
+   sync_trim        = sync_freq >> 6;
+   ARGB_sync_locked = 0;
+  }
+
+ OCR1A = USECOUNTER + sync_trim;
+#endif
+
+ // if the previous line has not finished (only when the application
+ // masks interrupts for most of a line) finish it now, late but in order
+ while (phase != PHASE_IDLE)
+  LinePhase();
+
+#if ARGB_STATS
+ StatsLine();
+#endif
+
+ // disable early, make display darker
+ if (ARGB_dark)
+  PORT_Lines &= ~BIT_Enable;
+
+#if ARGB_TRANSPORT == ARGB_TRANSPORT_SPI
+ SPCR = SPI_SPCR;
+#endif
+
+#if ARGB_LUT != ARGB_LUT_NONE
+ const byte * lr = lut_r;
+ const byte * lg = lut_g;
+ const byte * lb = lut_b;
+#endif
+
+#if ARGB_DITHER
+ // this line's phase, stepping each frame and staggered down the panel
+ const byte * dt = ARGB_dither_P[((byte)ARGB_frame_count + line) & 3];
+
+ if (lr == ARGB_gamma_P) lr = dt;
+ if (lg == ARGB_gamma_P) lg = dt;
+ if (lb == ARGB_gamma_P) lb = dt;
+#endif
+
+#if ARGB_STREAM
+ // the shift out is longer than the USART can buffer at stream rates,
+ // let it (and the rest) in. Compare B is off until ArmPhase() below,
+ // compare A is masked in case this ever runs into the next line.
+ TIMSK1 &= ~_BV(OCIE1A);
+#if ARGB_SYNC == ARGB_SYNC_SLAVE
+ // line and phase are between slots until ArmPhase(), SyncPosition()
+ // can't place an edge here. INTF0 holds it until we return, late but
+ // measured against a consistent line, and locked edges never land here.
+ EIMSK  &= ~_BV(INT0);
+#endif
+ sei();
+#endif
+
+ while (panels--)
+  { 
+   // Data is (R,G,B) per pixel. With the panels unrotated each line is
+   // contiguous, in right to left order as expected by the Rainbow Block
+
+#if ARGB_FORMAT == ARGB_INDEX4
+   unsigned int p = ps->start + line * ps->line_step;
+#else
+   byte * p    = outbuf + ps->start + line * ps->line_step;
+#endif
+   int    step = ps->pixel_step;
+   ps++;
+
+   Send16Bit(CmdMode);
+   SendNextPixel();
+   SendNextPixel();
+   SendNextPixel();
+   SendNextPixel();
+        
+   Send16Bit(CmdMode);
+   SendNextPixel();
+   SendNextPixel();
+   SendNextPixel();
+   SendNextPixel();
+  }
+
+#if ARGB_TRANSPORT == ARGB_TRANSPORT_SPI
+ // release MOSI back to PORT_Data (low) so it can be pulsed to latch
+ SPCR = 0;
+#endif
+
+#if ARGB_STREAM
+ cli();
+ TIMSK1 |= _BV(OCIE1A);
+#if ARGB_SYNC == ARGB_SYNC_SLAVE
+ EIMSK  |= _BV(INT0);
+#endif
+#endif
+
+#if ARGB_DEPTH == 12
+ // too late for a whole 12 bit PWM cycle, use 8 bits from the next line
+ if (TCNT1 > DEPTH12_BUDGET)
+  ARGB_depth = 8;
+#endif
+
+ ArmPhase(PHASE_BLANK,US_TICKS(30));
+ TIMSK1 |= _BV(OCIE1B);
+
+ STATS_END();
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+ STATS_START();
 
- // give new row data time to settle before renabling display
- // anything less than this creates ghosts
- // note: MY9221 in 8 bit mode latches quickly, in >= 12 bit mode
- //       it did not latch before the next interrupt.
+ LinePhase();
 
- delayMicroseconds(30);
- PORT_Lines |= BIT_Enable;  
+ STATS_END();
 }
 
 RGBDisplay Argb;
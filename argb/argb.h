@@ -57,12 +57,15 @@
 #include <Arduino.h>
 #include <avr/pgmspace.h>
 
-// The library works with 1 to 3 panels. 2 are expected for the clock.
-// With 3, the double buffers use significant RAM. you could comment out the
-// off screen buffer bits if you need more.
+// The most panels the library will drive. The actual number and how they
+// are arranged is passed to init(). 2 are expected for the clock.
+// With 3 the built in double buffers use significant RAM. To size RAM for
+// each sign instead, set ARGB_STATIC_BUFFERS to 0 and pass init() your
+// own buffers of ARGB_BUFFER_SIZE(panels) bytes.
 ///
 
 #define ARGB_PANELS            1
+#define ARGB_STATIC_BUFFERS    1
 
 // Frame rate: for integral counter, either 100Hz or 125Hz.
 // 100Hz gives more time for processing  (1.25ms per line)
@@ -70,62 +73,487 @@
 // don't use other values unless you understand the math this affects
 #define ARGB_FRAMERATE 125
 
-#define ARGB_MAX_X        (8*ARGB_PANELS)
-#define ARGB_MAX_Y        8
+// MY9221 transport, picks how the ISR shifts out pixel data:
+//
+// ARGB_TRANSPORT_BITBANG: the standard Rainbow Block wiring, D8 = clock
+//   and D9 = data. Works with any board but the ISR toggles every bit.
+//
+// ARGB_TRANSPORT_SPI: hardware SPI, D11 (MOSI) = data, D13 (SCK) = clock.
+//   About 2-3 times faster. The MY9221 clocks data on BOTH edges of DCKI but
+//   SPI makes a full clock pulse per bit, so SCK must drive DCKI through a
+//   divide-by-two toggle flip-flop (eg: 74HC74 with /Q wired to D, SCK to
+//   CLK, Q to DCKI). D13 is no longer available for the board LED.
+//
+// The USART in SPI master mode was considered but its clock (XCK) is D4,
+// which is one of the row select lines.
+#define ARGB_TRANSPORT_BITBANG 0
+#define ARGB_TRANSPORT_SPI     1
+
+#define ARGB_TRANSPORT ARGB_TRANSPORT_BITBANG
+
+// SPI transport only: 1 = 8MHz SPI clock, 0 = 4MHz for long cable runs
+#define ARGB_SPI_2X    1
+
+// Framebuffer format:
+//
+// ARGB_RGB24:  3 bytes per pixel. Full colour with alpha blending.
+// ARGB_INDEX8: 1 byte per pixel, a palette index. 1/3 of the RAM.
+// ARGB_INDEX4: 2 pixels per byte, a palette index. 1/6 of the RAM.
+//
+// With the indexed formats the colour passed to the drawing functions
+// carries the palette index in its low byte, see MakeIndex(). Alpha only
+// decides if anything is drawn (0 = nothing), there is no blending and
+// Fade() is not available: change the palette to dim or recolour instead.
+#define ARGB_RGB24        0
+#define ARGB_INDEX8       1
+#define ARGB_INDEX4       2
+
+#define ARGB_FORMAT       ARGB_RGB24
+
+// palette entries for the indexed formats. INDEX8 can use up to 256
+// (3 bytes of RAM each) but must be a power of 2.
+#define ARGB_PALETTE_SIZE 16
+
+// Output lookup tables. Each channel value is passed through a 256 entry
+// table as it is shifted out, for gamma, global brightness and white
+// balance without touching the framebuffers. Dimming is a table swap.
+//
+// ARGB_LUT_NONE:    values are sent as stored
+// ARGB_LUT_RAM:     tables in SRAM, see ARGB_BuildLUT(). init() builds a
+//                   256 byte gamma table used by all channels.
+// ARGB_LUT_PROGMEM: tables in flash, init() selects ARGB_gamma_P.
+//                   Costs a few cycles per channel more than RAM.
+// At ARGB_DEPTH 12 the defaults are linear instead, see there.
+#define ARGB_LUT_NONE     0
+#define ARGB_LUT_RAM      1
+#define ARGB_LUT_PROGMEM  2
+
+#define ARGB_LUT          ARGB_LUT_NONE
+
+// MY9221 grayscale depth, 8 or 12 bits. At 12 bits each channel is sent
+// as a 12 bit value from ARGB_gamma12_P, removing the banding of 8 bit
+// PWM at low levels. Words then take twice as long to send, so use the
+// SPI transport. The ISR times the shift out of every line and if it
+// leaves too little of the line for a whole 12 bit PWM cycle it falls
+// back to 8 bits, ARGB_depth then reads 8. Set it back to 12 to retry.
+// 14 and 16 bit PWM cycles are longer than a line and can't be used.
+// Any ARGB_LUT tables are applied before the gamma table, so must be
+// linear (ie: brightness and white balance only). init() then selects
+// a linear table (ARGB_linear_P with ARGB_LUT_PROGMEM) and ARGB_BuildLUT()
+// builds linear tables by default.
+#define ARGB_DEPTH        8
+
+#if ARGB_DEPTH != 8 && ARGB_DEPTH != 12
+#error ARGB_DEPTH must be 8 or 12
+#endif
+
+// 1 = temporal dithering of the default gamma table, for smooth low
+// levels at 8 bits. The curve is kept to 10 bits as 4 tables of 8 bit
+// values, the ISR picking one for each line by (frame + line) & 3 so the
+// in between steps average out over 4 frames. Channels given their own
+// table by ARGB_SetLUT() are not dithered. Needs ARGB_LUT_PROGMEM, costs
+// 1K of flash and nothing per pixel.
+#define ARGB_DITHER       0
+
+#if ARGB_DITHER && ARGB_LUT != ARGB_LUT_PROGMEM
+#error ARGB_DITHER needs ARGB_LUT_PROGMEM
+#endif
+
+#if ARGB_DITHER && ARGB_DEPTH == 12
+#error ARGB_DITHER is for 8 bit depth, 12 bits has the steps already
+#endif
+
+// 1 = the refresh ISR keeps timing statistics, see ARGB_GetStats().
+// Costs a few us per line.
+#define ARGB_STATS        0
+
+// Several controllers on one sign. The master pulses D2 every frame,
+// wire it to D2 (INT0) of every slave and share ground. Slaves trim their
+// refresh timer to stay in phase, so frames, ARGB_user_frame and
+// ARGB_frame_count tick together on all boards. See ARGB_SetCanvas().
+// A slave's count never goes back, one that is ahead stops counting for
+// up to 127 frames until the master catches up.
+// D2 is otherwise one of the clock's button inputs, so a clock sketch
+// built with sync needs that button moved to another pin.
+#define ARGB_SYNC_NONE    0
+#define ARGB_SYNC_MASTER  1
+#define ARGB_SYNC_SLAVE   2
+
+#define ARGB_SYNC         ARGB_SYNC_NONE
+
+// 1 = frames can be streamed in over the USART (D0/D1), see argbstream.h.
+// Its receive interrupt replaces Serial, which must not be used.
+#define ARGB_STREAM       0
+
+// Samples kept by the ISR in the ADC capture ring, 0 for none. The ISR
+// reads one per line (8 per frame) into ARGB_adcring, a power of 2 from
+// 16 to 256. Whole halves are handed over so the application can work
+// on one block of ARGB_ADC_RING / 2 while the ISR fills the other, see
+// ARGB_GetADCBlock().
+#define ARGB_ADC_RING     0
+
+#if ARGB_ADC_RING && (ARGB_ADC_RING < 16 || ARGB_ADC_RING > 256 || (ARGB_ADC_RING & (ARGB_ADC_RING - 1)))
+#error ARGB_ADC_RING must be 0 or a power of 2 from 16 to 256
+#endif
+
+// each panel is 8x8 pixels, scanned by the ISR as 8 lines
+#define ARGB_PANEL_SIZE   8
+#define ARGB_LINES        8
+
+// framebuffer bytes for a number of pixels
+#if ARGB_FORMAT == ARGB_INDEX4
+#define ARGB_BYTES(pixels) ((pixels) / 2)
+#elif ARGB_FORMAT == ARGB_INDEX8
+#define ARGB_BYTES(pixels) (pixels)
+#else
+#define ARGB_BYTES(pixels) ((pixels) * 3)
+#endif
+
+// bytes for one framebuffer of n panels
+#define ARGB_BUFFER_SIZE(n) ARGB_BYTES((n) * ARGB_PANEL_SIZE * ARGB_PANEL_SIZE)
+
+// display size in pixels, set by init() from the geometry
+extern byte ARGB_width;
+extern byte ARGB_height;
+
+#define ARGB_MAX_X        ARGB_width
+#define ARGB_MAX_Y        ARGB_height
+
+// panel arrangements. Panels are numbered along the data chain, 0 is the
+// one plugged into the controller.
+#define ARGB_HORIZONTAL   0   // 0 on the left, chained left to right
+#define ARGB_VERTICAL     1   // 0 on top, chained top to bottom
+#define ARGB_TILED        2   // rows of 'columns' panels, left to right
+                              // then down to the next row
+
+struct ARGB_Geometry
+{
+ byte panels;       // 1..ARGB_PANELS
+ byte arrangement;  // ARGB_HORIZONTAL, ARGB_VERTICAL or ARGB_TILED
+ byte columns;      // ARGB_TILED only: panels across
+ byte rotation;     // clockwise quarter turns of the image on each panel
+};
 
 typedef int           POINT;
 typedef uint32_t      ARGB;
 
+// alpha modes for the templated drawing functions, eg:
+//   Argb.FillRect<ARGB_OPAQUE>(0,0,4,4,0xFF400000);
+// ARGB_OPAQUE ignores the colour's alpha, ARGB_BLEND always blends.
+// The plain versions check alpha once per call, pick one of these and
+// skip drawing entirely when alpha is 0.
+#define ARGB_OPAQUE 1
+#define ARGB_BLEND  2
+
 // real time clock/timing info from ISR
 extern volatile byte          ARGB_user_frame;           // ISR sets every frame, user clears
+extern volatile unsigned long ARGB_frame_count;          // frames sent since init(), see ARGB_Frames()
 extern volatile unsigned int  ARGB_clock_ms;             // counts ms
-extern volatile byte          ARGB_adcdata[ARGB_MAX_Y];  // analog samples
+extern volatile byte          ARGB_adcdata[ARGB_LINES];  // analog samples
 extern byte                   ARGB_dark;                 // set for dimmer display
+extern volatile byte          ARGB_depth;                // grayscale bits being sent
+
+#if ARGB_LUT != ARGB_LUT_NONE
+// gamma 2.2 at full brightness, in flash
+extern const byte ARGB_gamma_P[256] PROGMEM;
+
+// Select the output tables, one per channel (can be the same table).
+// They must be in the memory ARGB_LUT says. 0 selects the init() default.
+extern void ARGB_SetLUT(const byte * r,const byte * g,const byte * b);
+
+#if ARGB_DEPTH == 12
+// identity, the default at 12 bits where ARGB_gamma12_P does the curve
+extern const byte ARGB_linear_P[256] PROGMEM;
+#endif
+
+// ARGB_BuildLUT() curves, gamma 2.2 or straight
+#define ARGB_CURVE_GAMMA  0
+#define ARGB_CURVE_LINEAR 1
+
+#if ARGB_DEPTH == 12
+#define ARGB_CURVE        ARGB_CURVE_LINEAR
+#else
+#define ARGB_CURVE        ARGB_CURVE_GAMMA
+#endif
+
+// Fill a RAM table with the curve scaled by brightness and a channel
+// gain (both 255 = full), eg: for white balance
+//   ARGB_BuildLUT(lut_r,level,255);
+//   ARGB_BuildLUT(lut_g,level,180);
+//   ARGB_BuildLUT(lut_b,level,230);
+//   ARGB_SetLUT(lut_r,lut_g,lut_b);   // ARGB_LUT_RAM only
+extern void ARGB_BuildLUT(byte * table,byte brightness,byte gain,byte curve = ARGB_CURVE);
+#endif
+
+#if ARGB_DITHER
+// ARGB_gamma_P to 10 bits, one table per dither phase
+extern const byte ARGB_dither_P[4][256] PROGMEM;
+#endif
+
+#if ARGB_DEPTH == 12
+// channel value to 12 bit gamma 2.2 output, in flash
+extern const unsigned int ARGB_gamma12_P[256] PROGMEM;
+#endif
+
+#if ARGB_STATS
+// Refresh ISR timing in TCNT1 ticks (16 per us). A line is the time
+// the ISR spends shifting out one row plus its blank/latch/enable phases.
+struct ARGB_Stats
+{
+ unsigned int  min_ticks;   // quickest line
+ unsigned int  max_ticks;   // slowest line
+ unsigned int  avg_ticks;   // average line
+ unsigned int  line_ticks;  // one line slot, 1 / (8 * ARGB_FRAMERATE)
+ byte          load;        // percent of the CPU used by the ISR on average
+ unsigned long frames;      // frames sent
+ unsigned long missed;      // frames ended with ARGB_user_frame still set,
+                            // ie: loop() took longer than a frame
+};
+
+// copy the statistics since init() or the last reset
+extern void ARGB_GetStats(ARGB_Stats& stats);
+extern void ARGB_ResetStats();
+#endif
+
+#if ARGB_ADC_RING
+// set by the ISR as each half of the ring fills, cleared by the application
+#define ARGB_ADC_HALF     1   // first half, ARGB_adcring[0..ARGB_ADC_RING/2-1]
+#define ARGB_ADC_FULL     2   // second half
+
+extern volatile byte          ARGB_adcring[ARGB_ADC_RING];
+extern volatile byte          ARGB_adc_ready;   // ARGB_ADC_HALF | ARGB_ADC_FULL
+extern volatile unsigned long ARGB_adc_blocks;  // half blocks filled since init()
+
+// The last filled half of the ring, 0 if none since the previous call.
+// It stays unchanged for ARGB_ADC_RING / 2 line slots, 1/(8 * ARGB_FRAMERATE)
+// seconds each, while the ISR fills the other half. block is set to its
+// sequence number, block n starting at frame n * ARGB_ADC_RING / 16. A gap
+// means blocks were missed.
+extern const volatile byte * ARGB_GetADCBlock(unsigned long & block);
+
+// beat detection by energy, one block of samples at a time
+struct ARGB_Beat
+{
+ unsigned int energy;    // of the last block, mean square about its mean
+ unsigned int average;   // recent energy, follows over about 16 blocks
+ byte         beat;      // 1 = last block was a beat
+};
+
+// Feed each block through this, returns 1 on a beat: energy above
+// average * ratio / 16 (24 = 1.5x) and above a small noise floor.
+// Zero beat before the first call, the first block only starts the average.
+extern byte ARGB_BeatDetect(const volatile byte * samples,byte n,ARGB_Beat & beat,byte ratio = 24);
+#endif
 
 // time of day updated by interrupt. Clock takes care in reading this
-// as reading it is not atomic
+// as reading it is not atomic, use ARGB_GetTime()
 extern volatile unsigned long ARGB_clock_tod;
 // set the time of day
 extern void ARGB_SetTime(unsigned long new_tod);
 
+#if ARGB_SYNC != ARGB_SYNC_NONE
+// Where this board's display sits on the whole sign, set for each board.
+// The drawing functions then take sign wide coordinates, so every board
+// can run the same drawing code, eg: scrolling text at x on the sign is
+// drawn at x on all of them. Shade() gets sign wide u, v, x and y. Fill,
+// Fade, the scrolls (and ScrollRect), the dirty rectangle and the MODE
+// templates still work in this board's own coordinates.
+extern POINT ARGB_canvas_x;
+extern POINT ARGB_canvas_y;
+extern void  ARGB_SetCanvas(POINT x,POINT y);
+#endif
+
+#if ARGB_SYNC == ARGB_SYNC_SLAVE
+extern volatile byte ARGB_sync_locked;   // 1 = in phase with the master
+extern volatile int  ARGB_sync_error;    // last phase error, TCNT1 ticks
+#endif
+
+// ms per frame, 8 or 10
+#define ARGB_FRAME_MS     (1000 / ARGB_FRAMERATE)
+
+// the clocks read together, all from the same frame
+struct ARGB_Time
+{
+ unsigned long tod;      // seconds within the day
+ unsigned int  ms;       // ms within the second
+ unsigned long frames;   // frames since init()
+ unsigned long uptime;   // ms since init(), wraps after 49 days
+};
+
+extern void          ARGB_GetTime(ARGB_Time & time);
+extern unsigned long ARGB_Frames();   // frames since init()
+extern unsigned long ARGB_Uptime();   // ms since init()
+
 // framebuffer_1 is sent to the panel. framebuffer_2 can be used
 // for compositing and merged/faded into buffer_1
-extern byte   framebuffer_1[ARGB_MAX_X * ARGB_MAX_Y * 3];
-extern byte   framebuffer_2[ARGB_MAX_X * ARGB_MAX_Y * 3];
+// Set up by init(), with a single buffer both point to it.
+extern byte * framebuffer_1;
+extern byte * framebuffer_2;
+
+// Sprites for DrawSprite(), a byte array:
+//
+//   w, h, flags,
+//   [palette: count (0 = 256), count colours,]
+//   pixels, rows top to bottom, each left to right
+//
+// Colours are 4 bytes A,R,G,B, see ARGB_SPRITE_COLOR(). In the indexed
+// formats they are MakeIndex() colours, ie: the index is the B byte.
+// With ARGB_SPRITE_PALETTE each pixel is a byte indexing the palette.
+// With ARGB_SPRITE_RLE the pixels are packets, runs can carry on from one
+// row to the next:
+//   0x00..0x7F  n+1 pixels follow
+//   0x80..0xFF  one pixel follows, repeated (n & 0x7F)+1 times
+#define ARGB_SPRITE_PALETTE  1
+#define ARGB_SPRITE_RLE      2
+
+#define ARGB_SPRITE_COLOR(c) (byte)((c) >> 24),(byte)((c) >> 16),(byte)((c) >> 8),(byte)(c)
+
+// how DrawSprite() uses pixel alpha
+#define ARGB_SPRITE_OPAQUE   0   // ignored, every pixel drawn
+#define ARGB_SPRITE_KEY      1   // alpha 0 not drawn, the rest opaque
+#define ARGB_SPRITE_ALPHA    2   // blended
+
+#if ARGB_FORMAT == ARGB_RGB24
+// Terms for a Shade() pass. u and v are linear in x and y, set them and
+// their steps for pixel (0,0) and Shade() keeps them updated by adding
+// the steps, eg: binary angles for isinb() of a plasma:
+//
+//   void Plasma(byte * rgb,ARGB_Shading & s)
+//   {
+//    int w = (isinb(s.u) >> 9) + (isinb(s.v) >> 9);   // -128..126
+//    *rgb = 128 + w;  *(rgb+1) = 0;  *(rgb+2) = 127 - w;
+//   }
+//
+//   ARGB_Shading s = {frame * 8,frame * 3,40,0,0,32};
+//   Argb.Shade(Plasma,s);
+struct ARGB_Shading
+{
+ unsigned int u,v;         // at (0,0), restored when Shade() returns
+ int          du_x,du_y;   // u steps per pixel right and per row down
+ int          dv_x,dv_y;
+ unsigned int t;           // free for the effect, eg: time
+ POINT        x,y;         // set by Shade(), pixel being shaded
+};
+
+// writes R,G,B of the pixel at rgb
+typedef void (*ARGB_Shader)(byte * rgb,ARGB_Shading & s);
+#endif
 
 class RGBDisplay
 {
  byte * framebuffer;   // points to buffer for drawing below
 
+ // dirty rectangle, everything drawn since ClearDirty(). empty if x2 < x1
+ POINT  dirty_x1,dirty_y1,dirty_x2,dirty_y2;
+
+ void   MarkDirty(POINT x1,POINT y1,POINT x2,POINT y2);
+
+ // SetPixel without dirty marking
+ template <byte MODE> void Plot(POINT x,POINT y,ARGB color);
+
+ // DrawBitmap1bpp from RAM or PROGMEM
+ template <byte MODE,byte PGM>
+ void Bitmap1bpp(const byte * bitmap,POINT px,POINT py,byte w,byte h,ARGB color);
+ template <byte PGM>
+ void Bitmap1bppFrac(const byte * bitmap,POINT px,POINT py,byte fx,byte fy,byte w,byte h,ARGB color);
+
+ // DrawSprite from RAM or PROGMEM
+ void SpriteRun(POINT x,POINT y,byte n,ARGB color,byte mode);
+ template <byte PGM>
+ void Sprite(const byte * sprite,POINT px,POINT py,byte mode);
+
  public:
 
+ // init() with no arguments drives ARGB_PANELS panels left to right from
+ // the built in buffers. Otherwise buffer1 (and buffer2 for double
+ // buffering) must be ARGB_BUFFER_SIZE(geometry.panels) bytes, or 0 for
+ // the built in buffers. Both are cleared. With ARGB_STATIC_BUFFERS 0
+ // there are none, buffer1 must be given and the display stays off if
+ // it is 0.
+#if ARGB_STATIC_BUFFERS
  void init();
+ void init(const ARGB_Geometry & geometry,
+           byte * buffer1 = 0,
+           byte * buffer2 = 0);
+#else
+ void init(const ARGB_Geometry & geometry,
+           byte * buffer1,
+           byte * buffer2 = 0);
+#endif
+
+ // dirty rectangle tracking. Drawing functions record the area they
+ // touch (clipped to the display) so copy, fade and blend can be limited
+ // to just what changed. Tracking is shared by both buffers.
+ void ClearDirty();
+ void MarkAllDirty()   {MarkDirty(0,0,ARGB_MAX_X-1,ARGB_MAX_Y-1);}
+ byte IsDirty()        {return dirty_x2 >= dirty_x1;}
+ byte GetDirty(POINT & x1,POINT & y1,POINT & x2,POINT & y2); // 0 if clean
 
  // double buffering:
  void SelectMainBuffer() {framebuffer = framebuffer_1;}
  void SelectAltBuffer()  {framebuffer = framebuffer_2;}
- void CopyAltToMain();
- void CopyMainToAlt();
+
+ // draw into any buffer of ARGB_BUFFER_SIZE bytes, eg: a layer
+ void SelectBuffer(byte * buffer) {framebuffer = buffer;}
+ byte * SelectedBuffer()          {return framebuffer;}
+ // dirty_only = 1 limits these to the dirty rectangle
+ void CopyAltToMain(byte dirty_only = 0);
+ void CopyMainToAlt(byte dirty_only = 0);
+
+ // page flipping: display the buffer we've been drawing into from the
+ // start of the next frame and select the other buffer for drawing.
+ // Until that frame starts the new draw buffer is still on display, so
+ // either wait here or check SwapPending() before drawing into it.
+ // After a swap framebuffer_2 may be the displayed one.
+ void SwapBuffers(byte wait = 1);
+ byte SwapPending();
 
  // this suppors partial off screen for x position, returns width in pixels
  byte DrawChar(byte  ascii,
                POINT px,
                POINT py,
                ARGB  color);
+ template <byte MODE>
+ byte DrawChar(byte ascii,POINT px,POINT py,ARGB color);
+
+ // draws a string laid out as 1 + DrawChar() per character, skipping
+ // characters off screen. Returns the width, as MeasureText()
+ int  DrawText(const char * str,POINT px,POINT py,ARGB color);
 
  // this supports partial off screen for x position
  void DrawDigit(byte  digit, // 0..9, 10 = colon
                 POINT px,    // top left
                 POINT py,
                 ARGB  color);
+ template <byte MODE>
+ void DrawDigit(byte digit,POINT px,POINT py,ARGB color);
 
  // this scrolls numeric digits
- void BlendDigits(byte  digit1,  // top digit, 0..9, 10 or 255 for none
-                  byte  digit2,  // bottom digit 0..9, 10 or 255 for none
-                  byte  blend,   // 0..255 for shift up percentage
+ void BlendDigits(byte  digit1,      // top digit, 0..9, 10 or 255 for none
+                  byte  digit2,      // bottom digit 0..9, 10 or 255 for none
+                  byte  blend,       // 0..255 for shift up percentage
                   POINT px,
                   POINT py,
-                  ARGB  color);
+                  ARGB  color,
+                  byte  smooth = 0); // 1 = move by fractions of a pixel
+
+ // 1 bit bitmaps in the font format: a byte per column, bit 0 at the top.
+ // Bitmaps taller than 8 rows are strips of w bytes one after the other,
+ // rows 0..7, then 8..15, etc. Lit bits are drawn, the rest left as is.
+ void DrawBitmap1bpp(const byte * bitmap,POINT px,POINT py,byte w,byte h,ARGB color);
+ void DrawBitmap1bpp_P(const byte * bitmap,POINT px,POINT py,byte w,byte h,ARGB color);
+
+ // as above, fx and fy move the bitmap a further fx/256 of a pixel right
+ // and fy/256 down. Each pixel is blended by how much of it the moved
+ // bitmap covers, for smooth motion. Indexed formats draw pixels that
+ // are at least half covered.
+ void DrawBitmap1bppFrac(const byte * bitmap,POINT px,POINT py,byte fx,byte fy,byte w,byte h,ARGB color);
+ void DrawBitmap1bppFrac_P(const byte * bitmap,POINT px,POINT py,byte fx,byte fy,byte w,byte h,ARGB color);
+
+ // colour sprites, see ARGB_SPRITE_PALETTE, clipped to the display.
+ // Runs of the same colour are drawn as spans.
+ void DrawSprite(const byte * sprite,POINT px,POINT py,byte mode = ARGB_SPRITE_ALPHA);
+ void DrawSprite_P(const byte * sprite,POINT px,POINT py,byte mode = ARGB_SPRITE_ALPHA);
   
  void Clear();
  void SetPixel(POINT x,POINT Y,ARGB color);
@@ -137,10 +565,92 @@ class RGBDisplay
  void DrawCircle(POINT poX, POINT poY, byte r, ARGB color);
  void FillCircle(POINT poX, POINT poY, byte r, ARGB color);
  void DrawLine(POINT x0,POINT y0,POINT x1,POINT y1,ARGB color);
- void Fade(byte alpha);
- void ScrollLeft(byte steps);
+#if ARGB_FORMAT == ARGB_RGB24
+ void Fade(byte alpha,byte dirty_only = 0);
+ // dst = a cross-faded to b by ratio, 0 = a .. 255 = b. dst may be a or b.
+ // dirty_only = 1 limits it to the rows of the dirty rectangle
+ void BlendBuffers(byte * dst,const byte * a,const byte * b,byte ratio,byte dirty_only = 0);
+ // call shader for every pixel, walking the framebuffer in memory order
+ void Shade(ARGB_Shader shader,ARGB_Shading & s);
+#endif
+ // scroll the display, clearing the pixels uncovered or with wrap = 1
+ // rotating them round to the other side
+ void ScrollLeft(byte steps,byte wrap = 0);
+ void ScrollRight(byte steps,byte wrap = 0);
+ void ScrollUp(byte steps,byte wrap = 0);
+ void ScrollDown(byte steps,byte wrap = 0);
+
+ // scroll part of the display, dx > 0 right and dy > 0 down
+ void ScrollRect(POINT x,POINT y,byte w,byte h,int dx,int dy,byte wrap = 0);
+
+ // alpha specialised versions, MODE is ARGB_OPAQUE or ARGB_BLEND
+ template <byte MODE> void SetPixel(POINT x,POINT y,ARGB color);
+ template <byte MODE> void HLine(POINT x,POINT y,byte w,ARGB color);
+ template <byte MODE> void VLine(POINT x,POINT y,byte w,ARGB color);
+ template <byte MODE> void DrawRect(POINT x1,POINT y1,POINT x2,POINT y2,ARGB color);
+ template <byte MODE> void FillRect(POINT x,POINT y,byte w,byte h,ARGB color);
+ template <byte MODE> void DrawCircle(POINT poX, POINT poY, byte r, ARGB color);
+ template <byte MODE> void FillCircle(POINT poX, POINT poY, byte r, ARGB color);
+ template <byte MODE> void DrawLine(POINT x0,POINT y0,POINT x1,POINT y1,ARGB color);
 };
 
+template <byte MODE>
+inline void RGBDisplay::Plot(POINT x,POINT y,ARGB color)
+{
+ // NOTE: No range checking! Callers must take responsibility
+ // pixels ordered row-wise top-right to top-left in RGB order
+
+#if ARGB_FORMAT == ARGB_INDEX8
+
+ framebuffer[(ARGB_MAX_X - 1 - x) + (y * ARGB_MAX_X)] = color;
+
+#elif ARGB_FORMAT == ARGB_INDEX4
+
+ // first pixel of each pair in the high nibble
+ unsigned int i  = (ARGB_MAX_X - 1 - x) + (y * ARGB_MAX_X);
+ byte *       pb = framebuffer + (i >> 1);
+
+ if (i & 1)
+  *pb = (*pb & 0xF0) | ((byte)color & 0x0F);
+ else
+  *pb = (*pb & 0x0F) | ((byte)color << 4);
+
+#else
+
+ // get red pixel first
+ byte * pb = framebuffer + 3 * ((ARGB_MAX_X - 1 - x) + (y * ARGB_MAX_X));
+
+ // testing determiend its quicker to pluck the bytes rather than shift
+ byte * pc = (byte*)(&color);
+
+ if (MODE == ARGB_OPAQUE)
+  {
+   *(pb++) = *(pc+2);
+   *(pb++) = *(pc+1);
+   *pb     = *pc;
+  }
+ else
+  {
+   byte a  = *(pc+3);
+   byte a1 = ~a;
+
+   *pb = ((unsigned int)a1 * (*pb) + (unsigned int)a * *(pc+2)) >> 8;
+   pb++;
+   *pb = ((unsigned int)a1 * (*pb) + (unsigned int)a * *(pc+1)) >> 8;
+   pb++;
+   *pb = ((unsigned int)a1 * (*pb) + (unsigned int)a * *pc) >> 8;
+  }
+
+#endif
+}
+
+template <byte MODE>
+inline void RGBDisplay::SetPixel(POINT x,POINT y,ARGB color)
+{
+ MarkDirty(x,y,x,y);
+ Plot<MODE>(x,y,color);
+}
+
 inline ARGB MakeARGB(byte a,byte r,byte g,byte b)
 {
  ARGB c;
@@ -160,9 +670,28 @@ inline ARGB SetAlpha(ARGB color,byte alpha)
 inline void swap(ARGB & a,ARGB & b)
 { ARGB temp = a; a = b; b = temp; }
 
+// font metrics from a table, no drawing. CharWidth() is what DrawChar()
+// returns, MeasureText() the total of 1 + CharWidth() for each character,
+// eg: to centre, draw at (ARGB_MAX_X - MeasureText(str)) / 2
+extern byte CharWidth(byte ascii);
+extern int  MeasureText(const char * str);
+
 // primary color table, pure R,G,B at 0,4,8 and blends are 1-3,5-7,9-11
 extern ARGB GetBaseColor(byte ci);
 
+// indexed formats: a colour that draws palette entry 'index'
+inline ARGB MakeIndex(byte index)
+{ return 0xFF000000 | index; }
+
+// Palette for the indexed formats. init() loads 0 = black, 1..12 = the
+// base colours (GetBaseColor(index - 1)), 13 = white and 14, 15 = greys.
+// Changes show from the next line sent, so this is also a cheap way to
+// fade or flash everything drawn in one colour.
+#if ARGB_FORMAT != ARGB_RGB24
+extern void ARGB_SetPalette(byte index,ARGB color);
+extern ARGB ARGB_GetPalette(byte index);
+#endif
+
 // smoothly blend two colors from the color table
 extern ARGB BlendBaseColors(byte ci1,         // first color index, 0-11
                             byte ci2,         // second color index, 0-11                            
@@ -0,0 +1,189 @@
+#include "argblayers.h"
+
+//
+// Layer compositor for the ARGB library, see argblayers.h
+//
+
+#if ARGB_FORMAT == ARGB_RGB24
+
+char ARGBLayers::Add(byte * buffer,byte mode,byte opacity)
+{
+ if (count >= ARGB_LAYERS)
+  return -1;
+
+ Layer * l = &layers[count];
+
+ l->buffer  = buffer;
+ l->mode    = mode;
+ l->opacity = opacity;
+ l->y1      = 1;   // none, then all
+ l->y2      = 0;
+
+ Changed(count);
+
+ return count++;
+}
+
+void ARGBLayers::Changed(byte layer,POINT y1,POINT y2)
+{
+ Layer * l = &layers[layer];
+
+ if (y1 < 0)
+  y1 = 0;
+
+ if (y2 >= ARGB_MAX_Y)
+  y2 = ARGB_MAX_Y - 1;
+
+ if (y2 < y1)
+  return;
+
+ // grow the layer's rows to cover these
+ if (l->y2 < l->y1)
+  {
+   l->y1 = y1;
+   l->y2 = y2;
+  }
+ else
+  {
+   if (y1 < l->y1) l->y1 = y1;
+   if (y2 > l->y2) l->y2 = y2;
+  }
+}
+
+void ARGBLayers::SetOpacity(byte layer,byte opacity)
+{
+ if (layers[layer].opacity != opacity)
+  {
+   layers[layer].opacity = opacity;
+   Changed(layer);
+  }
+}
+
+void ARGBLayers::SetMode(byte layer,byte mode)
+{
+ if (layers[layer].mode != mode)
+  {
+   layers[layer].mode = mode;
+   Changed(layer);
+  }
+}
+
+byte ARGBLayers::Flatten(byte * out,byte force)
+{
+ // rows any layer changed, the other rows of out stay as they are
+ POINT y1 = ARGB_MAX_Y,y2 = -1;
+
+ for (byte i=0;i<count;i++)
+  {
+   Layer * l = &layers[i];
+
+   if (l->y2 >= l->y1)
+    {
+     if (l->y1 < y1) y1 = l->y1;
+     if (l->y2 > y2) y2 = l->y2;
+    }
+
+   l->y1 = 1;   // none
+   l->y2 = 0;
+  }
+
+ if (force)
+  {
+   y1 = 0;
+   y2 = ARGB_MAX_Y - 1;
+  }
+
+ if (y2 < y1)
+  return 0;
+
+ // rows are whole runs of the buffers
+ unsigned int start = 3 * y1 * ARGB_MAX_X;
+
+ // the visible layers, read in step with the output
+ const byte * src[ARGB_LAYERS];
+ byte         mode[ARGB_LAYERS];
+ byte         alpha[ARGB_LAYERS];
+ byte         n = 0;
+
+ for (byte i=0;i<count;i++)
+  if (layers[i].opacity)
+   {
+    src[n]   = layers[i].buffer + start;
+    mode[n]  = layers[i].mode;
+    alpha[n] = layers[i].opacity;
+    n++;
+   }
+
+ out += start;
+
+ unsigned int pixels = (y2 - y1 + 1) * ARGB_MAX_X;
+
+ while (pixels--)
+  {
+   // pixel built up bottom to top, starting from black
+   byte r = 0,g = 0,b = 0;
+
+   for (byte i=0;i<n;i++)
+    {
+     const byte * p  = src[i];
+     byte         a  = alpha[i];
+     byte         a1 = ~a;
+
+     src[i] += 3;
+
+     switch (mode[i])
+      {
+       case ARGB_LAYER_KEY:
+
+        if (!(*p | *(p+1) | *(p+2)))
+         break;
+
+        // fall through, not keyed out
+
+       case ARGB_LAYER_NORMAL:
+
+        if (a1)
+         {
+          r = ((unsigned int)a1 * r + (unsigned int)a * *p)     >> 8;
+          g = ((unsigned int)a1 * g + (unsigned int)a * *(p+1)) >> 8;
+          b = ((unsigned int)a1 * b + (unsigned int)a * *(p+2)) >> 8;
+         }
+        else
+         {
+          r = *p;
+          g = *(p+1);
+          b = *(p+2);
+         }
+        break;
+
+       case ARGB_LAYER_ADD:
+        {
+         unsigned int vr = r + (((unsigned int)a * *p)     >> 8);
+         unsigned int vg = g + (((unsigned int)a * *(p+1)) >> 8);
+         unsigned int vb = b + (((unsigned int)a * *(p+2)) >> 8);
+
+         if (!a1)
+          {
+           // full strength, exact
+           vr = r + *p;
+           vg = g + *(p+1);
+           vb = b + *(p+2);
+          }
+
+         r = (vr > 255) ? 255 : vr;
+         g = (vg > 255) ? 255 : vg;
+         b = (vb > 255) ? 255 : vb;
+        }
+        break;
+      }
+    }
+
+   *out++ = r;
+   *out++ = g;
+   *out++ = b;
+  }
+
+ return 1;
+}
+
+#endif
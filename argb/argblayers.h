@@ -0,0 +1,77 @@
+#ifndef ARGBLAYERS_H
+#define ARGBLAYERS_H
+
+//
+// Layer compositor for the ARGB library
+//
+// Holds up to ARGB_LAYERS layers, each a full frame buffer supplied by the
+// sketch (ARGB_BUFFER_SIZE bytes) with its own opacity and blend mode.
+// Flatten() merges them bottom to top into an output buffer in a single
+// pass, over only the rows some layer changed since the last Flatten().
+//
+//   byte sky[ARGB_BUFFER_SIZE(ARGB_PANELS)],text[ARGB_BUFFER_SIZE(ARGB_PANELS)];
+//
+//   layers.Add(sky);
+//   layers.Add(text,ARGB_LAYER_KEY);
+//
+//   Argb.SelectBuffer(text);            // draw into a layer
+//   ...
+//   layers.Changed(1,0,7);              // rows 0..7 of layer 1 were drawn
+//   layers.Flatten(framebuffer_1);
+//
+// RGB24 framebuffers only.
+//
+
+#include "argb.h"
+
+#define ARGB_LAYERS        4
+
+// blend modes
+#define ARGB_LAYER_NORMAL  0   // blend over the layers below by opacity
+#define ARGB_LAYER_ADD     1   // add, scaled by opacity, eg: glows
+#define ARGB_LAYER_KEY     2   // as normal but black pixels are transparent
+
+#if ARGB_FORMAT == ARGB_RGB24
+
+class ARGBLayers
+{
+ struct Layer
+ {
+  byte * buffer;
+  byte   mode;
+  byte   opacity;
+  byte   y1,y2;     // rows changed since Flatten(), none if y2 < y1
+ };
+
+ Layer layers[ARGB_LAYERS];
+ byte  count;
+
+ public:
+
+ ARGBLayers()                         {Reset();}
+
+ // remove all layers
+ void Reset()                         {count = 0;}
+
+ // adds a layer on top, returns its index or -1 if full
+ char Add(byte * buffer,byte mode = ARGB_LAYER_NORMAL,byte opacity = 255);
+
+ byte   Count()                       {return count;}
+ byte * Buffer(byte layer)            {return layers[layer].buffer;}
+
+ void SetOpacity(byte layer,byte opacity);
+ void SetMode(byte layer,byte mode);
+
+ // call after drawing into rows y1..y2 of the layer's buffer, all rows
+ // by default. eg: Changed(n,y1,y2) with Argb.GetDirty()'s rows.
+ void Changed(byte layer,POINT y1 = 0,POINT y2 = 255);
+
+ // merge the changed rows of the layers into out, or all of them if
+ // force is set. Returns 1 if out was updated. out must not be one of
+ // the layers.
+ byte Flatten(byte * out,byte force = 0);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+#include "argbsched.h"
+#include <avr/sleep.h>
+
+//
+// Frame scheduler for the ARGB library, see argbsched.h
+//
+
+void ARGBScheduler::Reset()
+{
+ for (byte i=0;i<ARGB_TASKS;i++)
+  tasks[i].period = 0;
+
+ // not read from the ISR until Run(), constructors run before init()
+ frame    = 0;
+ started  = 0;
+ overruns = 0;
+ missed   = 0;
+ sleep    = 0;
+}
+
+char ARGBScheduler::Every(unsigned int frames,ARGB_Task task)
+{
+ if (!frames)
+  frames = 1;
+
+ for (byte i=0;i<ARGB_TASKS;i++)
+  if (!tasks[i].period)
+   {
+    tasks[i].task   = task;
+    tasks[i].period = frames;
+    tasks[i].next   = frame + frames;
+    return i;
+   }
+
+ return -1;
+}
+
+char ARGBScheduler::EveryMs(unsigned int ms,ARGB_Task task)
+{
+ return Every((ms + ARGB_FRAME_MS / 2) / ARGB_FRAME_MS,task);
+}
+
+void ARGBScheduler::Stop(char handle)
+{
+ if (handle >= 0 && handle < ARGB_TASKS)
+  tasks[handle].period = 0;
+}
+
+void ARGBScheduler::Run()
+{
+ unsigned long now = ARGB_Frames();
+
+ if (!started)
+  {
+   // tasks added so far count from the first run
+   for (byte i=0;i<ARGB_TASKS;i++)
+    tasks[i].next += now - frame;
+
+   frame   = now;
+   started = 1;
+   return;
+  }
+
+ // wait for the frame after the one last run
+ if (now == frame)
+  {
+   if (sleep)
+    set_sleep_mode(SLEEP_MODE_IDLE);
+
+   while ((now = ARGB_Frames()) == frame)
+    if (sleep)
+     sleep_mode();   // woken by each line, ARGB_LINES per frame (1ms at
+                     // 125Hz), and its compare B phases
+  }
+
+ // more than one frame since the last run, the tasks took too long
+ overruns += now - frame - 1;
+ frame     = now;
+
+ // the stats count frames the application hasn't taken
+ ARGB_user_frame = 0;
+
+ for (byte i=0;i<ARGB_TASKS;i++)
+  {
+   Task * t = &tasks[i];
+
+   // signed differences, safe across wrap around. A task can stop
+   // itself, so the period is checked each time
+   for (byte runs=0;runs<ARGB_TASK_CATCHUP;runs++)
+    {
+     if (!t->period || (long)(frame - t->next) < 0)
+      break;
+
+     t->next += t->period;
+     t->task();
+    }
+
+   // still behind, skip to the next period from now
+   if (t->period && (long)(frame - t->next) >= 0)
+    {
+     unsigned long skip = (frame - t->next) / t->period + 1;
+
+     missed  += skip;
+     t->next += skip * t->period;
+    }
+  }
+}
@@ -0,0 +1,81 @@
+#ifndef ARGBSCHED_H
+#define ARGBSCHED_H
+
+//
+// Frame scheduler for the ARGB library
+//
+// Replaces the usual loop() pattern of spinning on ARGB_user_frame and
+// timing effects with frames % N. Tasks run every so many frames or ms,
+// both counted in display frames from the refresh ISR so they stay in
+// step with what is shown. Run() waits for the next frame, optionally in
+// idle sleep, then runs the tasks that are due.
+//
+//   ARGBScheduler sched;
+//
+//   void setup()
+//   {
+//    Argb.init();
+//    sched.Every(2,DrawEffect);      // every other frame
+//    sched.EveryMs(15000,NewText);   // every 15s
+//    sched.SetSleep(1);
+//   }
+//
+//   void loop()
+//   {
+//    sched.Run();
+//   }
+//
+
+#include "argb.h"
+
+#define ARGB_TASKS        8
+
+// a task late by several periods runs at most this many times to catch
+// up, the rest are skipped and counted as missed
+#define ARGB_TASK_CATCHUP 4
+
+typedef void (*ARGB_Task)();
+
+class ARGBScheduler
+{
+ struct Task
+ {
+  ARGB_Task     task;
+  unsigned int  period;   // frames, 0 = free slot
+  unsigned long next;     // frame it is next due
+ };
+
+ Task          tasks[ARGB_TASKS];
+ unsigned long frame;     // the frame being run
+ unsigned long overruns;  // frames that went by while tasks were running
+ unsigned long missed;    // task runs skipped
+ byte          sleep;
+ byte          started;   // frame has been read from the ISR
+
+ public:
+
+ ARGBScheduler()                      {Reset();}
+
+ // remove all tasks and clear the counts
+ void Reset();
+
+ // Add a task every period frames or ms (rounded to whole frames), first
+ // run after one period. Returns its handle or -1 if there is no room.
+ char Every(unsigned int frames,ARGB_Task task);
+ char EveryMs(unsigned int ms,ARGB_Task task);
+
+ void Stop(char handle);
+
+ // 1 = wait for frames in idle sleep, woken by the refresh interrupt
+ void SetSleep(byte on)               {sleep = on;}
+
+ // wait for the next frame and run the tasks due, in the order added.
+ // Call from loop(), the first call only starts counting.
+ void Run();
+
+ unsigned long Frame()                {return frame;}
+ unsigned long Overruns()             {return overruns;}
+ unsigned long Missed()               {return missed;}
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "argbstream.h"
+
+//
+// Frame streaming over the USART for the ARGB library, see argbstream.h
+//
+
+#if ARGB_STREAM
+
+#include <avr/interrupt.h>
+
+// receive states
+#define RX_SYNC1   0
+#define RX_SYNC2   1
+#define RX_TYPE    2
+#define RX_ROW     3
+#define RX_ROWS    4
+#define RX_DATA    5   // rx_left bytes to rx_p
+#define RX_CODE    6   // 'L' packet code
+#define RX_RUN     7   // 'L' repeated unit
+#define RX_DONE    8   // waiting for ARGB_StreamPoll()
+#define RX_ERROR   9   // ditto, but to be discarded
+
+// 'L' unit, a pixel or for the indexed formats a byte
+#if ARGB_FORMAT == ARGB_RGB24
+#define UNIT 3
+#else
+#define UNIT 1
+#endif
+
+volatile unsigned int ARGB_stream_errors = 0;
+
+static volatile byte  rx_state = RX_SYNC1;
+static byte *         rx_p;          // next byte of the draw buffer
+static unsigned int   rx_left;       // bytes left in the packet
+static unsigned int   rx_code;       // 'L' literal bytes or repeats left
+static byte           rx_unit[UNIT]; // repeated unit so far
+static byte           rx_n;          // its bytes so far
+static byte           rx_row;        // 'R' first row
+static byte           rx_rows;       // rows written, 0 = the whole frame
+static volatile byte  rx_frame;      // frame of the last byte, for the timeout
+static byte           rx_filling;    // an 'L' run is being filled
+
+static byte           flipping = 0;  // SwapBuffers() done, waiting for it
+
+// rows of the draw buffer behind what is shown, none if stale_y2 < stale_y1
+static byte           stale_y1,stale_y2;
+
+static inline unsigned int RowBytes()
+{
+ return ARGB_BYTES(ARGB_MAX_X);
+}
+
+static inline unsigned int BufferBytes()
+{
+ return ARGB_BYTES(ARGB_MAX_X * ARGB_MAX_Y);
+}
+
+void ARGB_StreamBegin(unsigned long baud)
+{
+ cli();
+ UCSR0A   = _BV(U2X0);
+ UBRR0    = (16000000L / 8 + baud / 2) / baud - 1;
+ UCSR0C   = _BV(UCSZ01) | _BV(UCSZ00);                // 8N1
+ UCSR0B   = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+ rx_state = RX_SYNC1;
+ flipping = 0;
+ stale_y1 = 0;                 // don't know what the sketch drew
+ stale_y2 = ARGB_MAX_Y - 1;
+ sei();
+}
+
+static void Send(byte b)
+{
+ while (!(UCSR0A & _BV(UDRE0)))
+  ;
+ UDR0 = b;
+}
+
+// start writing a packet of n bytes at byte offset start of the draw buffer
+static inline void RxStart(byte state,unsigned int start,unsigned int n)
+{
+ rx_p     = Argb.SelectedBuffer() + start;
+ rx_left  = n;
+ rx_state = state;
+}
+
+ISR(USART_RX_vect)
+{
+ // status before the data, lost or broken bytes spoil the packet
+ byte err   = UCSR0A & (_BV(DOR0) | _BV(FE0));
+ byte c     = UDR0;
+ byte state = rx_state;
+
+ rx_frame = ARGB_frame_count;
+
+ if (err && state != RX_DONE)
+  state = RX_ERROR;
+
+ switch (state)
+  {
+   case RX_SYNC1:
+
+    if (c == ARGB_STREAM_SYNC1)
+     rx_state = RX_SYNC2;
+    break;
+
+   case RX_SYNC2:
+
+    rx_state = (c == ARGB_STREAM_SYNC2) ? RX_TYPE : (c == ARGB_STREAM_SYNC1) ? RX_SYNC2 : RX_SYNC1;
+    break;
+
+   case RX_TYPE:
+
+    rx_rows = 0;
+    rx_code = 0;
+
+    if (c == 'F')
+     RxStart(RX_DATA,0,BufferBytes());
+    else if (c == 'L')
+     RxStart(RX_CODE,0,BufferBytes());
+    else if (c == 'R')
+     rx_state = RX_ROW;
+    else
+     rx_state = RX_ERROR;
+    break;
+
+   case RX_ROW:
+
+    rx_row   = c;
+    rx_state = RX_ROWS;
+    break;
+
+   case RX_ROWS:
+
+    if (!c || rx_row + c > ARGB_MAX_Y)
+     rx_state = RX_ERROR;
+    else
+     {
+      rx_rows = c;
+      RxStart(RX_DATA,rx_row * RowBytes(),c * RowBytes());
+     }
+    break;
+
+   case RX_DATA:
+
+    *rx_p++ = c;
+
+    if (!--rx_left)
+     rx_state = RX_DONE;
+    else if (rx_code && !--rx_code)
+     rx_state = RX_CODE;   // end of an 'L' literal
+    break;
+
+   case RX_CODE:
+
+    {
+     unsigned int n = (unsigned int)((c & 0x7F) + 1) * UNIT;
+
+     if (n > rx_left)
+      rx_state = RX_ERROR;
+     else if (c & 0x80)
+      {
+       rx_code  = c & 0x7F;   // repeats after the first
+       rx_n     = 0;
+       rx_state = RX_RUN;
+      }
+     else
+      {
+       rx_code  = n;
+       rx_state = RX_DATA;
+      }
+    }
+    break;
+
+   case RX_RUN:
+
+    rx_unit[rx_n++] = c;
+    *rx_p++ = c;
+
+    if (rx_n == UNIT)
+     {
+      // the packet carries on after the run, so move past it first
+      byte * p    = rx_p;
+      byte   left = rx_code;
+
+      rx_p    += (unsigned int)left * UNIT;
+      rx_left -= (unsigned int)(left + 1) * UNIT;
+      rx_code  = 0;
+      rx_state = rx_left ? RX_CODE : RX_DONE;
+
+      // A long run takes longer than the USART can buffer, so let the
+      // following bytes in while filling it. They land after the run,
+      // and the main loop can't poll before this returns. Only the
+      // outer run nests, one arriving meanwhile is filled as it is.
+#if UNIT == 3
+      byte r = rx_unit[0],g = rx_unit[1],b = rx_unit[2];
+#endif
+      byte nest = !rx_filling;
+
+      if (nest)
+       {
+        rx_filling = 1;
+        sei();
+       }
+
+#if UNIT == 3
+      while (left--)
+       {
+        *p++ = r;
+        *p++ = g;
+        *p++ = b;
+       }
+#else
+      memset(p,c,left);
+#endif
+
+      if (nest)
+       {
+        cli();
+        rx_filling = 0;
+       }
+     }
+    break;
+
+   case RX_ERROR:
+
+    rx_state = RX_ERROR;
+    break;
+
+   // RX_DONE: dropped until polled
+  }
+}
+
+byte ARGB_StreamPoll()
+{
+ byte state = rx_state;
+
+ if (state == RX_ERROR ||
+     (state != RX_SYNC1 && state != RX_DONE && (byte)((byte)ARGB_frame_count - rx_frame) > ARGB_STREAM_TIMEOUT))
+  {
+   cli();
+   rx_state = RX_SYNC1;
+   sei();
+
+   // whatever of it arrived is in the draw buffer
+   stale_y1 = 0;
+   stale_y2 = ARGB_MAX_Y - 1;
+
+   ARGB_stream_errors++;
+   Send(ARGB_STREAM_ERROR);
+   return 0;
+  }
+
+ if (state != RX_DONE)
+  return 0;
+
+ // packet rows, all of them for 'F' and 'L'
+ byte y1 = rx_rows ? rx_row : 0;
+ byte y2 = rx_rows ? rx_row + rx_rows - 1 : ARGB_MAX_Y - 1;
+
+ if (!flipping)
+  {
+   // Rows an 'R' packet didn't carry must match what is shown. Only the
+   // stale ones need copying, so after whole frames there are none.
+   byte * draw  = Argb.SelectedBuffer();
+   byte * shown = (draw == framebuffer_1) ? framebuffer_2 : framebuffer_1;
+
+   if (shown != draw && stale_y2 >= stale_y1)
+    {
+     if (stale_y1 < y1)
+      {
+       byte n = ((stale_y2 < y1) ? stale_y2 + 1 : y1) - stale_y1;
+
+       memcpy(draw + stale_y1 * RowBytes(),shown + stale_y1 * RowBytes(),n * RowBytes());
+      }
+
+     if (stale_y2 > y2)
+      {
+       byte from = (stale_y1 > y2) ? stale_y1 : y2 + 1;
+
+       memcpy(draw + from * RowBytes(),shown + from * RowBytes(),(stale_y2 + 1 - from) * RowBytes());
+      }
+    }
+
+   // once flipped the new draw buffer is behind by this packet's rows
+   stale_y1 = y1;
+   stale_y2 = y2;
+
+   Argb.SwapBuffers(0);
+   flipping = 1;
+  }
+
+ if (Argb.SwapPending())
+  return 0;
+
+ flipping = 0;
+ rx_state = RX_SYNC1;
+ Send(ARGB_STREAM_ACK);
+
+ return 1;
+}
+
+#endif
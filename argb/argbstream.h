@@ -0,0 +1,56 @@
+#ifndef ARGBSTREAM_H
+#define ARGBSTREAM_H
+
+//
+// Frame streaming over the USART for the ARGB library, ARGB_STREAM 1
+//
+// The receive interrupt writes pixels straight into the draw buffer in
+// the framebuffer's own layout: rows top to bottom, each right to left,
+// ARGB_BYTES(1) per pixel (R,G,B for RGB24, pixel pairs for INDEX4).
+// Once a packet is complete ARGB_StreamPoll() flips it onto the display
+// and acks, so use double buffering. Packets are:
+//
+//   0xA5 0x5A 'F' <frame bytes>                 whole frame
+//   0xA5 0x5A 'R' <row> <rows> <rows of bytes>  rows, eg: only those changed
+//   0xA5 0x5A 'L' <packets>                     whole frame run length coded
+//
+// 'L' packets are units of 3 bytes for RGB24, otherwise 1 byte:
+//   0x00..0x7F  n+1 units follow
+//   0x80..0xFF  one unit follows, repeated (n & 0x7F)+1 times
+//
+// After each packet is shown 'K' is sent back, the host should wait for
+// it before sending the next. Bytes arriving before then are dropped.
+// A packet left unfinished for ARGB_STREAM_TIMEOUT frames is discarded
+// and 'E' sent, as is one of an unknown type, with rows off the display
+// or with a byte lost to an overrun or framing error.
+//
+// The refresh ISR enables interrupts while it shifts a line out, and
+// so does the receive ISR while it fills a long 'L' run, so bytes keep
+// being taken at full rate. Other interrupt handlers should be short.
+//
+
+#include "argb.h"
+
+#if ARGB_STREAM
+
+#define ARGB_STREAM_SYNC1    0xA5
+#define ARGB_STREAM_SYNC2    0x5A
+
+#define ARGB_STREAM_ACK      'K'
+#define ARGB_STREAM_ERROR    'E'
+
+#define ARGB_STREAM_TIMEOUT  12   // frames, about 100ms
+
+// set up the USART, 8N1. 500000 or 1000000 divide evenly at 16MHz.
+extern void ARGB_StreamBegin(unsigned long baud);
+
+// Call from loop(). Shows a completed packet, returns 1 once it is on
+// display and the host has been sent the ack.
+extern byte ARGB_StreamPoll();
+
+// packets discarded, see above
+extern volatile unsigned int ARGB_stream_errors;
+
+#endif
+
+#endif
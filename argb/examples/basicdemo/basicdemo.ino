@@ -98,9 +98,12 @@ void loop()
    Argb.SelectMainBuffer();
    Argb.CopyAltToMain();
 
-   // clock_tod counts time of day, use it to re-trigger text
+   // tod counts time of day, use it to re-trigger text
    // every 15 seconds here
-   if (ARGB_clock_tod % 15 == 0)
+   ARGB_Time now;
+   ARGB_GetTime(now);
+
+   if (now.tod % 15 == 0)
     {
      // get a random colour and blend the text colour with it
 
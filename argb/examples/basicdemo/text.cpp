@@ -10,9 +10,14 @@
 // a few pixels for "unfade" time
 #define CHAR_TEST_WIDTH 8
 
+extern byte simpleFont[][8];    // font.c
+
 void TextDisplay::Reset()
 {
  *out_text  = 0;
+#if TEXT_STRIP
+ strip_len  = 0;
+#endif
  color      = 0xFFFFFFFF;
 
  step_ticks = 5;                 // how many ticks for each step
@@ -34,6 +39,42 @@ void TextDisplay::Set(const char * str)
  Reset();
  strncpy(out_text,str,MAX_TEXT);
  out_text[MAX_TEXT] = '\0';
+ BuildStrip();
+}
+
+void TextDisplay::BuildStrip()
+{
+#if TEXT_STRIP
+ // same layout as DrawChar: columns 0..width of each glyph, where width
+ // is its last lit column. Blank glyphs (space) take one column.
+ unsigned int len  = 0;
+ unsigned int last = 0;
+
+ for (char * c=out_text;*c;c++)
+  {
+   byte ascii = *c;
+
+   if ((ascii < 0x20) || (ascii > 0x7e))
+    ascii = '-';
+
+   const byte * glyph = simpleFont[ascii-0x20];
+   byte         width = CharWidth(ascii);
+
+   if (len + width + 1 > TEXT_STRIP)
+    {
+     strip_len = 0;   // too long, draw per character
+     return;
+    }
+
+   last = len;
+
+   for (byte i=0;i<=width;i++)
+    strip[len++] = pgm_read_byte(&glyph[i]);
+  }
+
+ strip_len  = len;
+ strip_last = last;
+#endif
 }
 
 void TextDisplay::Update()
@@ -53,6 +94,27 @@ void TextDisplay::Update()
    if ((text_px >= ARGB_MAX_X) && (text_px <= (ARGB_MAX_X + 4)))
     Argb.Fade(text_fade + 0x10 * (text_px - ARGB_MAX_X));
    else
+#if TEXT_STRIP
+   if (strip_len)
+    {
+     // as the per character path, while a glyph starts in the margin
+     if (text_px < ARGB_MAX_X && text_px + strip_last > -CHAR_TEST_WIDTH)
+      Argb.Fade(text_fade);
+
+     // how far through this step we are, 0..255
+     byte frac = smooth ? (unsigned int)(step_ticks - step_count) * 256 / step_ticks : 0;
+
+     // clipped to the columns on the display. Left by a fraction is
+     // right by 1 - fraction from one pixel further left
+     if (frac)
+      Argb.DrawBitmap1bppFrac(strip,text_px-1,0,256-frac,0,strip_len,8,color);
+     else
+      Argb.DrawBitmap1bpp(strip,text_px,0,strip_len,8,color);
+
+     text_px += strip_len;
+    }
+   else
+#endif
     while ((text_px < ARGB_MAX_X) && *c)
      {
       if (!did_fade && (text_px > -CHAR_TEST_WIDTH))  // will be visible
@@ -61,7 +123,14 @@ void TextDisplay::Update()
         Argb.Fade(text_fade);
        }
       
-      text_px += 1 + Argb.DrawChar(*(c++),text_px,0,color);
+      // characters already scrolled off the left are only measured
+      byte width = CharWidth(*c);
+
+      if (text_px + width >= 0)
+       Argb.DrawChar(*c,text_px,0,color);
+
+      text_px += 1 + width;
+      c++;
      }
 
    // nothing shown - set end until we get reset
@@ -2,6 +2,12 @@
 #define TEXT_H
 
 #define MAX_TEXT 64
+
+// Set() renders messages up to this many pixels wide into a strip of font
+// columns, so each scroll step only draws the visible columns. Longer
+// messages are drawn character by character. 0 to save the RAM, at
+// most 255.
+#define TEXT_STRIP 96
  
 class TextDisplay
 {
@@ -11,16 +17,30 @@ class TextDisplay
  byte   step_count;
  int    x_scroll;
 
+#if TEXT_STRIP
+ byte   strip[TEXT_STRIP];
+ byte   strip_len;          // 0 when the message didn't fit
+ byte   strip_last;         // column the last glyph starts at
+#endif
+ byte   smooth;             // move by fractions of a pixel between steps
+
  void   Tick();
+ void   BuildStrip();
  
  public:
 
+ TextDisplay()                 {smooth = 0; Reset();}
+
  void Reset();
  void Update();
  void Set(const char * str);
 
  void SetSpeed(byte t)         {step_ticks = step_count = t;}
 
+ // 1 = anti-aliased motion on every tick rather than a pixel per step,
+ // smooth looking at slower speeds (messages that fit the strip only)
+ void SetSmooth(byte s)        {smooth = s;}
+
  void SetColor(ARGB c)         {color = c;}
  ARGB Color()                  {return color;}
 };
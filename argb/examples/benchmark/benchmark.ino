@@ -0,0 +1,184 @@
+/*
+  ARGB library benchmark
+
+  Times each RGBDisplay drawing function and the colour blending helpers,
+  first with the display refresh ISR running and then with it stopped,
+  and prints a table of CPU cycles per call to Serial at 115200 baud.
+
+  The difference between the two columns is the share of each call lost
+  to the ISR, so run this with the panel count and ARGB_FRAMERATE you
+  are choosing between. Each call is timed on its own from TCNT1, which
+  counts CPU cycles through every line slot whether or not the refresh
+  interrupts run, and each figure is the average of many calls. A call
+  that takes longer than one line slot wraps and reads short.
+*/
+
+#include <argb.h>
+
+typedef void (*BenchFn)();
+
+// results land here so the compiler can't drop the blending calls
+volatile ARGB sink;
+
+// repeats per measurement
+#define REPS 64
+
+// the ISR reads TCNT1 too, so the two byte read is done with it held off
+static unsigned int ReadTCNT1()
+{
+ cli();
+ unsigned int t = TCNT1;
+ sei();
+ return t;
+}
+
+static unsigned long Cycles(BenchFn fn)
+{
+ unsigned long total = 0;
+ unsigned int  top   = OCR1A + 1;
+
+ for (byte i=0;i<REPS;i++)
+  {
+   unsigned int t0 = ReadTCNT1();
+   fn();
+   unsigned int t1 = ReadTCNT1();
+
+   // TCNT1 restarts at 0 after OCR1A
+   total += (t1 >= t0) ? t1 - t0 : t1 + top - t0;
+  }
+
+ return total / REPS;
+}
+
+struct Bench
+{
+ const char * name;   // in PROGMEM
+ BenchFn      fn;
+};
+
+// captureless lambdas, each is one call of the function being timed
+#define BENCH(name,op) { name, []() { op; } }
+
+static const char n_empty[]      PROGMEM = "(call overhead)";
+static const char n_clear[]      PROGMEM = "Clear";
+static const char n_fill[]       PROGMEM = "Fill";
+static const char n_fade[]       PROGMEM = "Fade";
+static const char n_faded[]      PROGMEM = "Fade dirty";
+static const char n_setpixel[]   PROGMEM = "SetPixel";
+static const char n_hline[]      PROGMEM = "HLine full width";
+static const char n_vline[]      PROGMEM = "VLine full height";
+static const char n_fillrect[]   PROGMEM = "FillRect 8x8 opaque";
+static const char n_fillrectb[]  PROGMEM = "FillRect 8x8 blend";
+static const char n_drawrect[]   PROGMEM = "DrawRect 8x8";
+static const char n_circle[]     PROGMEM = "DrawCircle r3";
+static const char n_fcircle[]    PROGMEM = "FillCircle r3";
+static const char n_line[]       PROGMEM = "DrawLine 8x8 diagonal";
+static const char n_char[]       PROGMEM = "DrawChar";
+static const char n_digit[]      PROGMEM = "DrawDigit";
+static const char n_blenddig[]   PROGMEM = "BlendDigits";
+static const char n_scroll[]     PROGMEM = "ScrollLeft 1";
+static const char n_copy[]       PROGMEM = "CopyAltToMain";
+static const char n_copyd[]      PROGMEM = "CopyAltToMain dirty";
+static const char n_copyalt[]    PROGMEM = "CopyMainToAlt";
+static const char n_swap[]       PROGMEM = "SwapBuffers no wait";
+static const char n_blendargb[]  PROGMEM = "BlendARGB";
+static const char n_blendbase[]  PROGMEM = "BlendBaseColors";
+
+static const Bench benches[] =
+{
+ BENCH(n_empty,     ),
+ BENCH(n_clear,     Argb.Clear()),
+ BENCH(n_fill,      Argb.Fill(0xFF204080)),
+ BENCH(n_fade,      Argb.Fade(200)),
+ BENCH(n_faded,     Argb.Fade(200,1)),
+ BENCH(n_setpixel,  Argb.SetPixel(3,4,0xFF204080)),
+ BENCH(n_hline,     Argb.HLine(0,4,ARGB_MAX_X,0xFF204080)),
+ BENCH(n_vline,     Argb.VLine(4,0,ARGB_MAX_Y,0xFF204080)),
+ BENCH(n_fillrect,  Argb.FillRect(0,0,8,8,0xFF204080)),
+ BENCH(n_fillrectb, Argb.FillRect(0,0,8,8,0x80204080)),
+ BENCH(n_drawrect,  Argb.DrawRect(0,0,8,8,0xFF204080)),
+ BENCH(n_circle,    Argb.DrawCircle(4,4,3,0xFF204080)),
+ BENCH(n_fcircle,   Argb.FillCircle(4,4,3,0xFF204080)),
+ BENCH(n_line,      Argb.DrawLine(0,0,7,7,0xFF204080)),
+ BENCH(n_char,      Argb.DrawChar('W',0,0,0xFF204080)),
+ BENCH(n_digit,     Argb.DrawDigit(8,0,0,0xFF204080)),
+ BENCH(n_blenddig,  Argb.BlendDigits(3,4,100,0,0,0xFF204080)),
+ BENCH(n_scroll,    Argb.ScrollLeft(1)),
+ BENCH(n_copy,      Argb.CopyAltToMain()),
+ BENCH(n_copyd,     Argb.CopyAltToMain(1)),
+ BENCH(n_copyalt,   Argb.CopyMainToAlt()),
+ // waiting would time the frame, and never return with the ISR stopped
+ BENCH(n_swap,      Argb.SwapBuffers(0)),
+ BENCH(n_blendargb, sink = BlendARGB(0xFF204080,0xFF802040,100,200)),
+ BENCH(n_blendbase, sink = BlendBaseColors(2,7,100,200)),
+};
+
+#define BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static unsigned long with_isr[BENCHES];
+static unsigned long without_isr[BENCHES];
+
+static void RunAll(unsigned long * results)
+{
+ for (byte i=0;i<BENCHES;i++)
+  results[i] = Cycles(benches[i].fn);
+}
+
+static void PrintP(const char * s,byte width)
+{
+ char c;
+ byte n = 0;
+
+ while ((c = pgm_read_byte(s++)))
+  {
+   Serial.print(c);
+   n++;
+  }
+
+ while (n++ < width)
+  Serial.print(' ');
+}
+
+void setup()
+{
+ Serial.begin(115200);
+ Argb.init();
+
+ RunAll(with_isr);
+
+ // stop the refresh just after a frame, the panels hold their last line
+ ARGB_user_frame = 0;
+ while (!ARGB_user_frame)
+  ;
+ delay(1);
+
+ // TIMER0 overflow too, or millis() would still take its share
+ byte timsk0 = TIMSK0;
+
+ TIMSK0 &= ~_BV(TOIE0);
+ TIMSK1 &= ~(_BV(OCIE1A) | _BV(OCIE1B));
+ RunAll(without_isr);
+ TIMSK1 |= _BV(OCIE1A);
+ TIMSK0  = timsk0;
+
+ Serial.print(F("ARGB benchmark, "));
+ Serial.print(ARGB_PANELS);
+ Serial.print(F(" panel(s) at "));
+ Serial.print(ARGB_FRAMERATE);
+ Serial.println(F("Hz, cycles per call"));
+ Serial.println();
+ Serial.println(F("                        ISR on  ISR off"));
+
+ for (byte i=0;i<BENCHES;i++)
+  {
+   PrintP(benches[i].name,22);
+   Serial.print(' ');
+   Serial.print(with_isr[i]);
+   Serial.print('\t');
+   Serial.println(without_isr[i]);
+  }
+}
+
+void loop()
+{
+}
@@ -0,0 +1,210 @@
+// Host benchmark and golden image check of the RGBDisplay primitives.
+//
+//   ./bench           check goldens, print ns per call
+//   ./bench -update   print new goldens for this build's column below
+//
+// Each test draws a fixed pseudo random scene. The CRC of the resulting
+// framebuffer must match its golden value, so an optimisation that
+// changes any pixel fails. There is a golden for each configuration the
+// Makefile builds: the default argb.h, 3 panels, and INDEX8.
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include "hostsim.h"
+#include "argb.h"
+
+#if ARGB_FORMAT == ARGB_INDEX8 && ARGB_PANELS == 1
+#define CONFIG 2
+#define CONFIG_NAME "index8"
+#elif ARGB_FORMAT == ARGB_RGB24 && ARGB_PANELS == 3
+#define CONFIG 1
+#define CONFIG_NAME "panels3"
+#elif ARGB_FORMAT == ARGB_RGB24 && ARGB_PANELS == 1
+#define CONFIG 0
+#define CONFIG_NAME "default"
+#else
+#error no goldens for this configuration
+#endif
+
+struct Test
+{
+ const char * name;
+ void      (* draw)(int n);
+ int          calls;
+ uint32_t     golden[3];    // default, panels3, index8
+};
+
+// own generator, the goldens must not depend on the C library's rand()
+static uint32_t seed;
+
+static int Rnd(int n)
+{
+ seed = seed * 1103515245 + 12345;
+ return (seed >> 16) % n;
+}
+
+static ARGB RndColor() { return MakeARGB(Rnd(2) ? 255 : Rnd(256),Rnd(256),Rnd(256),Rnd(256)); }
+
+static void Fill(int n)
+{
+ while (n--)
+  Argb.Fill(RndColor() | 0xFF000000);
+}
+
+#if ARGB_FORMAT == ARGB_RGB24
+static void Fade(int n)
+{
+ Argb.Fill(0xFFFFC080);
+
+ while (n--)
+  Argb.Fade(200);
+}
+#endif
+
+static void FillRect(int n)
+{
+ while (n--)
+  Argb.FillRect(Rnd(12)-2,Rnd(12)-2,Rnd(8),Rnd(8),RndColor());
+}
+
+static void DrawCircle(int n)
+{
+ while (n--)
+  Argb.DrawCircle(Rnd(8),Rnd(8),Rnd(6),RndColor());
+}
+
+static void DrawLine(int n)
+{
+ while (n--)
+  Argb.DrawLine(Rnd(12)-2,Rnd(12)-2,Rnd(12)-2,Rnd(12)-2,RndColor());
+}
+
+static void DrawChar(int n)
+{
+ while (n--)
+  Argb.DrawChar(0x20 + Rnd(0x60),Rnd(10)-2,Rnd(4)-1,RndColor());
+}
+
+static void ScrollLeft(int n)
+{
+ while (n--)
+  {
+   Argb.VLine(ARGB_MAX_X-1,0,ARGB_MAX_Y,RndColor());
+   Argb.ScrollLeft(1 + Rnd(2));
+  }
+}
+
+static Test tests[] =
+{
+ { "Fill",       Fill,       20,  { 0xDF8B9C3B, 0xD0954C5F, 0x7E30EC58 } },
+#if ARGB_FORMAT == ARGB_RGB24
+ { "Fade",       Fade,       20,  { 0x8BFF08F2, 0x43EC18F3 } },
+#endif
+ { "FillRect",   FillRect,   200, { 0x4935E9AE, 0x0005D563, 0xC55EC957 } },
+ { "DrawCircle", DrawCircle, 200, { 0x246242B7, 0x20CBB841, 0x5AD00EDB } },
+ { "DrawLine",   DrawLine,   200, { 0x374AB80E, 0x36D91A0D, 0x28C4B2EE } },
+ { "DrawChar",   DrawChar,   200, { 0x6AE23383, 0x4A9CBE8F, 0x2241EDB2 } },
+ { "ScrollLeft", ScrollLeft, 50,  { 0x37057A65, 0xE0AE8F17, 0x3CA2E369 } },
+};
+
+static uint32_t Crc32(const byte * p,unsigned int len)
+{
+ uint32_t crc = 0xFFFFFFFF;
+
+ while (len--)
+  {
+   crc ^= *p++;
+
+   for (byte i=0;i<8;i++)
+    crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+
+ return ~crc;
+}
+
+// the channels the ISR should send for the framebuffer
+static const byte * Sent()
+{
+#if ARGB_FORMAT == ARGB_RGB24
+ return framebuffer_1;
+#else
+ static byte rgb[ARGB_PANELS * ARGB_PANEL_SIZE * ARGB_LINES * 3];
+
+ // through the palette, 0xRRGGBB to r,g,b
+ for (unsigned int i=0;i<sizeof(rgb) / 3;i++)
+  {
+   ARGB c = ARGB_GetPalette(framebuffer_1[i]);
+
+   rgb[i*3]   = c >> 16;
+   rgb[i*3+1] = c >> 8;
+   rgb[i*3+2] = c;
+  }
+
+ return rgb;
+#endif
+}
+
+// draw a test's scene from a known start
+static void Scene(const Test& t)
+{
+ seed = 1;
+ Argb.Clear();
+ t.draw(t.calls);
+}
+
+int main(int argc,char ** argv)
+{
+ bool update = argc > 1 && !strcmp(argv[1],"-update");
+ int  failed = 0;
+
+ printf(update ? "goldens for %s, column %d\n" : "%s\n",CONFIG_NAME,CONFIG);
+
+ Argb.init();
+
+ for (unsigned int i=0;i<sizeof(tests)/sizeof(tests[0]);i++)
+  {
+   const Test& t = tests[i];
+
+   Scene(t);
+
+   uint32_t crc = Crc32(framebuffer_1,ARGB_BUFFER_SIZE(ARGB_PANELS));
+
+   // repeat the scene for about 50ms to time it
+   typedef std::chrono::steady_clock Clock;
+
+   long          calls = 0;
+   Clock::time_point t0 = Clock::now();
+   double        ns;
+
+   do
+    {
+     Scene(t);
+     calls += t.calls;
+     ns     = std::chrono::duration<double,std::nano>(Clock::now() - t0).count();
+    }
+   while (ns < 50e6);
+
+   if (update)
+    printf("%-12s 0x%08X\n",t.name,crc);
+   else
+    {
+     bool ok = crc == t.golden[CONFIG];
+
+     printf("%-12s %8.1f ns/call  %s\n",t.name,ns / calls,ok ? "ok" : "GOLDEN MISMATCH");
+     failed += !ok;
+    }
+  }
+
+ // the ISR must send exactly what was drawn
+ for (unsigned int i=0;i<sizeof(tests)/sizeof(tests[0]);i++)
+  if (!strcmp(tests[i].name,"FillRect"))
+   Scene(tests[i]);
+ failed += HostSim_CheckFrame(Sent(),ARGB_PANELS) != 0;
+
+ if (!update)
+  printf(failed ? "FAILED\n" : "all ok\n");
+
+ return failed ? 1 : 0;
+}
@@ -0,0 +1,111 @@
+// Host simulator for the ARGB library, see hostsim.h
+
+#include <stdio.h>
+
+#include "hostsim.h"
+#include "argb.h"
+
+#define REG(name)   volatile uint8_t  name;
+#define REG16(name) volatile uint16_t name;
+
+REG(DDRB)   REG(PORTC)  REG(DDRC)   REG(DDRD)
+REG(TCCR1A) REG(TCCR1B) REG16(TCNT1)
+REG16(OCR1A) REG16(OCR1B) REG(TIMSK1) REG(TIFR1)
+REG(ADMUX)  REG(ADCSRA) REG(ADCSRB) REG(DIDR0)
+REG(ADCH)   REG(SPCR)   REG(SPSR)
+REG(PIND)   REG(EICRA)  REG(EIMSK)  REG(EIFR)
+
+SimPort PORTB, PORTD, SPDR;
+
+std::vector<byte> hostsim_bits;
+int               hostsim_latches = 0;
+
+// the bitbang transport: clock on PB0, data on PB1. The SPI transport
+// clocks each byte written to SPDR.
+#define SIM_CLK  0x01
+#define SIM_DATA 0x02
+
+void SimPort::write(uint8_t n)
+{
+ uint8_t changed = v ^ n;
+
+ v = n;
+
+ if (this == &PORTB)
+  {
+   if (changed & SIM_CLK)
+    hostsim_bits.push_back((n & SIM_DATA) ? 1 : 0);
+   else
+    if (changed & SIM_DATA)
+     hostsim_latches++;
+  }
+ else
+  if (this == &SPDR)
+   {
+    for (int i=7;i>=0;i--)
+     hostsim_bits.push_back((n >> i) & 1);
+
+    SPSR |= _BV(SPIF);
+   }
+}
+
+extern "C" void TIMER1_COMPA_vect(void);
+extern "C" void TIMER1_COMPB_vect(void);
+
+void HostSim_RunLine()
+{
+ TIMER1_COMPA_vect();
+
+ // each phase rearms compare B until the line is done
+ for (byte i=0;i<8 && (TIMSK1 & _BV(OCIE1B));i++)
+  TIMER1_COMPB_vect();
+}
+
+static unsigned int Word(size_t& b)
+{
+ unsigned int w = 0;
+
+ for (byte i=0;i<16;i++)
+  w = (w << 1) | hostsim_bits[b++];
+
+ return w;
+}
+
+int HostSim_CheckFrame(const byte * rgb,byte panels)
+{
+ int errors = 0;
+
+ for (byte line=0;line<ARGB_LINES;line++)
+  {
+   hostsim_bits.clear();
+   HostSim_RunLine();
+
+   // per panel: two chips of a command word and 12 channels
+   size_t want = (size_t)panels * 2 * 13 * 16;
+
+   if (hostsim_bits.size() != want)
+    {
+     printf("line %d: %d bits sent, expected %d\n",line,(int)hostsim_bits.size(),(int)want);
+     return errors + 1;
+    }
+
+   // panels are sent in framebuffer order, one line of each at a time
+   const byte * src = rgb + line * panels * ARGB_PANEL_SIZE * 3;
+   size_t       b   = 0;
+
+   for (byte p=0;p<panels * 2;p++)
+    {
+     Word(b);
+
+     for (byte c=0;c<12;c++,src++)
+      {
+       unsigned int v = Word(b);
+
+       if (v != *src && errors++ < 5)
+        printf("line %d chip %d channel %d: sent %u, expected %u\n",line,p,c,v,*src);
+      }
+    }
+  }
+
+ return errors;
+}
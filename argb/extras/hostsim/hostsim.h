@@ -0,0 +1,24 @@
+// Host simulator for the ARGB library. Runs the refresh ISR against
+// stub registers and decodes what reaches the MY9221 chain.
+
+#ifndef HOSTSIM_H
+#define HOSTSIM_H
+
+#include <vector>
+#include <Arduino.h>
+
+// bits clocked into the chain since the last clear, first bit first
+extern std::vector<byte> hostsim_bits;
+
+// data pulses without a clock, ie: latches
+extern int hostsim_latches;
+
+// run the ISR for one display line, compare A then each compare B phase
+extern void HostSim_RunLine();
+
+// Run a frame and check every channel sent matches 'rgb', the expected
+// image in framebuffer layout (3 bytes per pixel, as sent). Returns the
+// number of mismatches, printing the first few.
+extern int HostSim_CheckFrame(const byte * rgb,byte panels);
+
+#endif
@@ -0,0 +1,41 @@
+// Host build stand in for the parts of Arduino.h the library uses
+
+#ifndef HOSTSIM_ARDUINO_H
+#define HOSTSIM_ARDUINO_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+typedef bool    boolean;
+
+#define min(a,b) ((a) < (b) ? (a) : (b))
+#define max(a,b) ((a) > (b) ? (a) : (b))
+#define abs(x)   ((x) > 0 ? (x) : -(x))
+
+#define B00000000 0
+#define B00000111 7
+#define B00100000 32
+#define B00111111 63
+#define B01000000 64
+#define B10000000 128
+
+#define HIGH   1
+#define LOW    0
+#define INPUT  0
+#define OUTPUT 1
+
+inline void pinMode(uint8_t,uint8_t)      {}
+inline void digitalWrite(uint8_t,uint8_t) {}
+inline void delay(unsigned long)          {}
+inline void delayMicroseconds(unsigned)   {}
+
+inline long random(long n)        { return rand() % n; }
+inline long random(long a,long b) { return a + rand() % (b - a); }
+
+#endif
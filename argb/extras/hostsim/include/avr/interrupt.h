@@ -0,0 +1,11 @@
+// Host build: ISRs are plain functions the harness calls
+
+#ifndef HOSTSIM_INTERRUPT_H
+#define HOSTSIM_INTERRUPT_H
+
+#define ISR(vector) extern "C" void vector(void)
+
+#define sei() ((void)0)
+#define cli() ((void)0)
+
+#endif
@@ -0,0 +1,53 @@
+// Host build: ATmega328 registers as variables. PORTB and SPDR decode
+// what is written to them into the bits clocked into the MY9221 chain.
+
+#ifndef HOSTSIM_IO_H
+#define HOSTSIM_IO_H
+
+#include <stdint.h>
+
+#define HOSTSIM_REG(name)   extern volatile uint8_t  name;
+#define HOSTSIM_REG16(name) extern volatile uint16_t name;
+
+HOSTSIM_REG(DDRB)   HOSTSIM_REG(PORTC)  HOSTSIM_REG(DDRC)   HOSTSIM_REG(DDRD)
+HOSTSIM_REG(TCCR1A) HOSTSIM_REG(TCCR1B) HOSTSIM_REG16(TCNT1)
+HOSTSIM_REG16(OCR1A) HOSTSIM_REG16(OCR1B) HOSTSIM_REG(TIMSK1) HOSTSIM_REG(TIFR1)
+HOSTSIM_REG(ADMUX)  HOSTSIM_REG(ADCSRA) HOSTSIM_REG(ADCSRB) HOSTSIM_REG(DIDR0)
+HOSTSIM_REG(ADCH)   HOSTSIM_REG(SPCR)   HOSTSIM_REG(SPSR)
+HOSTSIM_REG(PIND)   HOSTSIM_REG(EICRA)  HOSTSIM_REG(EIMSK)  HOSTSIM_REG(EIFR)
+
+// a port that reports every write. int operands, as on the AVR, so
+// that ~mask expressions don't warn.
+struct SimPort
+{
+ uint8_t v;
+
+ void write(uint8_t n);
+
+ SimPort& operator=(int n)  { write(n);     return *this; }
+ SimPort& operator|=(int n) { write(v | n); return *this; }
+ SimPort& operator&=(int n) { write(v & n); return *this; }
+ SimPort& operator^=(int n) { write(v ^ n); return *this; }
+ operator uint8_t() const       { return v; }
+};
+
+extern SimPort PORTB, PORTD, SPDR;
+
+#define _BV(b) (1 << (b))
+
+// bits used by the library
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCF1A  1
+#define OCF1B  2
+#define CS10   0
+#define SPE    6
+#define MSTR   4
+#define SPIF   7
+#define SPI2X  0
+#define ISC00  0
+#define ISC01  1
+#define INT0   0
+#define INTF0  0
+
+#endif
@@ -0,0 +1,20 @@
+// Host build: flash is ordinary memory
+
+#ifndef HOSTSIM_PGMSPACE_H
+#define HOSTSIM_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// words are copied out, a cast would break the aliasing rules
+static inline uint16_t HostSim_ReadWord(const void * p)  { uint16_t v; memcpy(&v,p,sizeof(v)); return v; }
+static inline uint32_t HostSim_ReadDWord(const void * p) { uint32_t v; memcpy(&v,p,sizeof(v)); return v; }
+
+#define PROGMEM
+#define PSTR(s)           (s)
+#define pgm_read_byte(p)  (*(const uint8_t*)(p))
+#define pgm_read_word(p)  HostSim_ReadWord(p)
+#define pgm_read_dword(p) HostSim_ReadDWord(p)
+#define memcpy_P          memcpy
+
+#endif
@@ -0,0 +1,11 @@
+// Host build: there is nothing to sleep for, the harness runs the ISR
+
+#ifndef HOSTSIM_SLEEP_H
+#define HOSTSIM_SLEEP_H
+
+#define SLEEP_MODE_IDLE 0
+
+#define set_sleep_mode(mode) ((void)0)
+#define sleep_mode()         ((void)0)
+
+#endif
@@ -0,0 +1,100 @@
+// Host check of the ARGB_SYNC_SLAVE frame count resync, built against
+// argb.h with ARGB_SYNC_SLAVE. The master's long pulse lines a slave's
+// ARGB_frame_count up to a multiple of 256. Whether the slave starts
+// ahead of the master or behind it, its count must never go back and
+// ARGBScheduler must not see a wrapped overrun count.
+
+#include <stdio.h>
+
+#include "hostsim.h"
+#include "argb.h"
+#include "argbsched.h"
+
+extern "C" void INT0_vect(void);
+
+#define FRAMES 200   // run after the pulse
+
+static void Edge(byte high)
+{
+ TCNT1 = 3000;
+ PIND  = high ? 0x04 : 0;
+ INT0_vect();
+}
+
+static void Task() {}
+
+// the slave's count is 'start' the frame before the master's reaches a
+// multiple of 256, that frame ends during the pulse
+static int Check(unsigned long start)
+{
+ int errors = 0;
+
+ Argb.init();
+
+ for (byte l=0;l<ARGB_LINES;l++)
+  HostSim_RunLine();
+ ARGB_frame_count = start;
+
+ ARGBScheduler sched;
+ sched.Every(1,Task);
+ sched.Run();
+
+ // a long pulse, from the last line's enable to two lines on
+ for (byte l=0;l<ARGB_LINES - 1;l++)
+  HostSim_RunLine();
+ Edge(1);
+ HostSim_RunLine();
+ HostSim_RunLine();
+ sched.Run();
+ Edge(0);
+
+ unsigned long last = ARGB_Frames();
+
+ for (int f=0;f<FRAMES * ARGB_LINES;f++)
+  {
+   HostSim_RunLine();
+
+   unsigned long now = ARGB_Frames();
+
+   if (now < last && errors++ < 5)
+    printf("start 0x%lX: frames went back from 0x%lX to 0x%lX\n",start,last,now);
+
+   // Run() waits for the next frame, there is one
+   if (now != last)
+    sched.Run();
+   last = now;
+  }
+
+ // in step with the master, FRAMES after its multiple of 256
+ if ((byte)last != (byte)FRAMES)
+  {
+   printf("start 0x%lX: ended at 0x%lX, not in step\n",start,last);
+   errors++;
+  }
+
+ // a slave that was ahead waits for the master, one that was behind
+ // skips the frames it missed, 128 at most
+ byte          ahead = (byte)(start + 1) < 128;
+ unsigned long limit = ahead ? 0 : 128;
+
+ if (sched.Overruns() > limit)
+  {
+   printf("start 0x%lX: %lu overruns\n",start,sched.Overruns());
+   errors++;
+  }
+
+ return errors;
+}
+
+int main()
+{
+ static const unsigned long starts[] = {0x110,0x17E,0x17F,0x0F0,0x181};
+ int failed = 0;
+
+ for (unsigned int i=0;i<sizeof(starts)/sizeof(starts[0]);i++)
+  failed += Check(starts[i]);
+
+ printf(failed ? "sync FAILED\n" : "sync ok\n");
+
+ return failed ? 1 : 0;
+}
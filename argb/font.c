@@ -107,4 +107,22 @@ const unsigned char simpleFont[][8] PROGMEM=
   {0x00,0x02,0x05,0x05,0x02,0x00,0x00,0x00} 
 };
 
-
+// Per glyph of simpleFont: high nibble is the first lit column (left
+// bearing), low nibble the last lit column, 0 for blank glyphs. The low
+// nibble is the width DrawChar returns. Generated from the table above,
+// regenerate it if a glyph changes.
+const unsigned char simpleFontWidth[] PROGMEM=
+{
+  0x00,0x22,0x24,0x15,0x15,0x15,0x15,0x23,  //  !"#$%&'
+  0x13,0x13,0x15,0x15,0x12,0x15,0x12,0x15,  // ()*+,-./
+  0x15,0x24,0x15,0x15,0x15,0x15,0x15,0x15,  // 01234567
+  0x15,0x15,0x23,0x23,0x14,0x15,0x14,0x15,  // 89:;<=>?
+  0x15,0x15,0x15,0x15,0x15,0x15,0x15,0x15,  // @ABCDEFG
+  0x15,0x13,0x15,0x15,0x15,0x15,0x15,0x15,  // HIJKLMNO
+  0x15,0x15,0x15,0x15,0x15,0x15,0x15,0x15,  // PQRSTUVW
+  0x15,0x15,0x15,0x13,0x15,0x13,0x15,0x15,  // XYZ[\]^_
+  0x13,0x15,0x15,0x14,0x15,0x15,0x14,0x15,  // `abcdefg
+  0x15,0x22,0x13,0x14,0x13,0x15,0x14,0x14,  // hijklmno
+  0x14,0x14,0x24,0x14,0x13,0x14,0x15,0x15,  // pqrstuvw
+  0x15,0x14,0x15,0x13,0x22,0x13,0x15,0x14   // xyz{|}~
+};
@@ -4,4 +4,16 @@
 int isin(int angle);
 int icos(int angle);
 
+// Binary angles, ISIN_STEPS per turn so any unsigned value wraps without
+// a division. Results are Q15, -32767..32767 for -1..1, >> 7 gives the
+// -255..255 range of isin().
+#define ISIN_STEPS    1024
+#define ISIN_QUARTER  (ISIN_STEPS / 4)
+
+int  isinb(unsigned int angle);
+int  icosb(unsigned int angle);
+
+// sine and cosine together from the one pair of table reads
+void isincos(unsigned int angle,int & s,int & c);
+
 #endif